@@ -26,6 +26,26 @@
 #include <unistd.h>
 #include <signal.h>
 #include <stdio.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <sys/eventfd.h>
+
+/* In the default mode, a new subprocess is started for each query. With
+ * `persistent` or `persistent=<count>` as the first setting, the helpers
+ * are started once per backend instance and kept running. Requests carry
+ * an `id` line that the helper must repeat in the response, so that many
+ * queries can be pipelined over the same socket. Each helper has a thread
+ * reading the responses and waking up the respective query through an
+ * eventfd. Helpers that exit are started again for the next request.
+ *
+ * Requests are sent without holding the global lock, as the helper may
+ * stop reading until its thread drains the responses, which requires the
+ * lock. A separate lock per helper keeps concurrent requests from
+ * interleaving on the socket.
+ */
+#define MAX_HELPERS 16
 
 struct buffer {
 	char *buffer;
@@ -33,12 +53,51 @@ struct buffer {
 	char *end;
 };
 
+struct helper;
+
+struct request {
+	struct request *next;
+	struct helper *helper;
+	unsigned int id;
+	int fd;
+	char *data;
+	size_t length;
+	bool finished;
+	bool failed;
+};
+
+struct helper {
+	struct instance *instance;
+	pid_t pid;
+	int fd;
+	pthread_mutex_t send_lock;
+	pthread_t thread;
+	bool joinable;
+	bool exited;
+	struct request *requests;
+	int count;
+};
+
+struct instance {
+	struct instance *next;
+	char **command;
+	struct helper helpers[MAX_HELPERS];
+	int nhelpers;
+	unsigned int id;
+};
+
+static struct {
+	pthread_mutex_t lock;
+	struct instance *instances;
+} persistent = { PTHREAD_MUTEX_INITIALIZER };
+
 struct priv_exec {
 	int pid;
 	struct buffer inbuf;
 	int infd;
 	struct buffer outbuf;
 	int outfd;
+	struct request *request;
 };
 
 static bool
@@ -85,6 +144,320 @@ err_pipe1:
 	return false;
 }
 
+static bool
+start_helper(struct helper *helper)
+{
+	int sv[2];
+
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) == -1)
+		return false;
+	if ((helper->pid = fork()) == -1) {
+		close(sv[0]);
+		close(sv[1]);
+		return false;
+	}
+
+	if (!helper->pid) {
+		dup2(sv[1], 0);
+		dup2(sv[1], 1);
+		execvp(*helper->instance->command, helper->instance->command);
+		/* Subprocess error occured. */
+		fprintf(stderr, "error running %s: %s", *helper->instance->command, strerror(errno));
+		abort();
+	}
+
+	close(sv[1]);
+	helper->fd = sv[0];
+
+	debug("started helper %s (pid %d)", *helper->instance->command, (int) helper->pid);
+
+	return true;
+}
+
+static void
+finish_request(struct request *request, bool failed)
+{
+	struct request **p;
+	uint64_t value = 1;
+
+	for (p = &request->helper->requests; *p != request; p = &(*p)->next)
+		;
+	*p = request->next;
+	request->helper->count--;
+	request->helper = NULL;
+	request->finished = true;
+	request->failed = failed;
+
+	if (write(request->fd, &value, sizeof value) != sizeof value)
+		error("cannot signal request: %s", strerror(errno));
+}
+
+static struct request *
+find_request(struct helper *helper, unsigned int id)
+{
+	struct request *request;
+
+	for (request = helper->requests; request; request = request->next)
+		if (request->id == id)
+			return request;
+
+	return NULL;
+}
+
+static void
+append_line(struct request *request, const char *line, size_t length)
+{
+	char *data = realloc(request->data, request->length + length + 2);
+
+	if (!data)
+		return;
+
+	memcpy(data + request->length, line, length);
+	request->length += length;
+	data[request->length++] = '\n';
+	data[request->length] = '\0';
+	request->data = data;
+}
+
+static void *
+run_helper(void *data)
+{
+	struct helper *helper = data;
+	char buffer[4096];
+	size_t length = 0;
+	unsigned int id = 0;
+	bool have_id = false;
+	char *line, *nl;
+	ssize_t size;
+
+	while ((size = read(helper->fd, buffer + length, sizeof buffer - length)) > 0) {
+		length += size;
+
+		pthread_mutex_lock(&persistent.lock);
+		for (line = buffer; (nl = memchr(line, '\n', buffer + length - line)); line = nl + 1) {
+			struct request *request;
+
+			*nl = '\0';
+			if (!*line) {
+				if (have_id && (request = find_request(helper, id)))
+					finish_request(request, false);
+				have_id = false;
+			} else if (sscanf(line, "id %u", &id) == 1)
+				have_id = true;
+			else if (have_id && (request = find_request(helper, id)))
+				append_line(request, line, nl - line);
+		}
+		pthread_mutex_unlock(&persistent.lock);
+
+		length -= line - buffer;
+		memmove(buffer, line, length);
+		if (length == sizeof buffer) {
+			error("exec: response line too long");
+			break;
+		}
+	}
+
+	debug("helper %s (pid %d) exited", *helper->instance->command, (int) helper->pid);
+
+	pthread_mutex_lock(&persistent.lock);
+	while (helper->requests)
+		finish_request(helper->requests, true);
+	close(helper->fd);
+	helper->fd = -1;
+	waitpid(helper->pid, NULL, 0);
+	helper->pid = 0;
+	helper->exited = true;
+	pthread_mutex_unlock(&persistent.lock);
+
+	return NULL;
+}
+
+static struct instance *
+get_instance(char **settings)
+{
+	struct instance *instance;
+	char **p, **q;
+	int count = 0;
+	int n;
+
+	for (instance = persistent.instances; instance; instance = instance->next) {
+		for (p = settings + 1, q = instance->command; *p && *q; p++, q++)
+			if (strcmp(*p, *q))
+				break;
+		if (!*p && !*q)
+			return instance;
+	}
+
+	if (!(instance = calloc(1, sizeof *instance)))
+		return NULL;
+
+	if (sscanf(*settings, "persistent=%d", &n) == 1)
+		instance->nhelpers = n < 1 ? 1 : n > MAX_HELPERS ? MAX_HELPERS : n;
+	else
+		instance->nhelpers = 1;
+	for (p = settings + 1; *p; p++)
+		count++;
+	if (!count || !(instance->command = calloc(count + 1, sizeof *instance->command))) {
+		free(instance);
+		return NULL;
+	}
+	for (n = 0; n < count; n++)
+		instance->command[n] = strdup(settings[n + 1]);
+	for (n = 0; n < instance->nhelpers; n++) {
+		instance->helpers[n].instance = instance;
+		instance->helpers[n].fd = -1;
+		pthread_mutex_init(&instance->helpers[n].send_lock, NULL);
+	}
+
+	instance->next = persistent.instances;
+	persistent.instances = instance;
+
+	return instance;
+}
+
+/* submit_request:
+ *
+ * Send the request to the least busy helper of the instance, starting it
+ * when necessary.
+ */
+static struct request *
+submit_request(netresolve_query_t query, char **settings)
+{
+	const char *string = netresolve_get_request_string(query);
+	const char *rest;
+	struct instance *instance;
+	struct helper *helper = NULL;
+	struct request *request;
+	char *message = NULL;
+	int length;
+	int fd;
+	int i;
+
+	if (!string)
+		return NULL;
+	rest = strchr(string, '\n') + 1;
+
+	if (!(request = calloc(1, sizeof *request)))
+		return NULL;
+	if ((request->fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1) {
+		free(request);
+		return NULL;
+	}
+
+	pthread_mutex_lock(&persistent.lock);
+
+	if (!(instance = get_instance(settings)))
+		goto fail;
+
+	for (i = 0; i < instance->nhelpers; i++)
+		if (!helper || instance->helpers[i].count < helper->count)
+			helper = &instance->helpers[i];
+
+	if (helper->exited) {
+		pthread_join(helper->thread, NULL);
+		helper->joinable = false;
+		helper->exited = false;
+	}
+	if (!helper->pid) {
+		if (!start_helper(helper))
+			goto fail;
+		if (pthread_create(&helper->thread, NULL, run_helper, helper)) {
+			kill(helper->pid, SIGKILL);
+			waitpid(helper->pid, NULL, 0);
+			close(helper->fd);
+			helper->fd = -1;
+			helper->pid = 0;
+			goto fail;
+		}
+		helper->joinable = true;
+	}
+
+	request->id = ++instance->id;
+	length = asprintf(&message, "%.*sid %u\n%s", (int) (rest - string), string, request->id, rest);
+	if (length == -1)
+		goto fail;
+	/* The helper thread may close its descriptor once the lock is released. */
+	if ((fd = dup(helper->fd)) == -1)
+		goto fail;
+
+	request->helper = helper;
+	request->next = helper->requests;
+	helper->requests = request;
+	helper->count++;
+
+	pthread_mutex_unlock(&persistent.lock);
+
+	/* The socket is blocking, the helper's output is drained by its thread. */
+	pthread_mutex_lock(&helper->send_lock);
+	if (send(fd, message, length, MSG_NOSIGNAL) != length) {
+		error("exec: cannot send request: %s", strerror(errno));
+		pthread_mutex_lock(&persistent.lock);
+		if (request->helper)
+			finish_request(request, true);
+		pthread_mutex_unlock(&persistent.lock);
+	}
+	pthread_mutex_unlock(&helper->send_lock);
+	close(fd);
+	free(message);
+
+	return request;
+fail:
+	pthread_mutex_unlock(&persistent.lock);
+	free(message);
+	close(request->fd);
+	free(request);
+	return NULL;
+}
+
+static void
+cancel_request(struct request *request)
+{
+	struct request **p;
+
+	pthread_mutex_lock(&persistent.lock);
+	if (request->helper) {
+		for (p = &request->helper->requests; *p != request; p = &(*p)->next)
+			;
+		*p = request->next;
+		request->helper->count--;
+	}
+	pthread_mutex_unlock(&persistent.lock);
+
+	close(request->fd);
+	free(request->data);
+	free(request);
+}
+
+static void __attribute__((destructor))
+finalize(void)
+{
+	struct instance *instance;
+	struct helper *helper;
+	char **p;
+	int i;
+
+	pthread_mutex_lock(&persistent.lock);
+	for (instance = persistent.instances; instance; instance = instance->next)
+		for (i = 0; i < instance->nhelpers; i++)
+			if (instance->helpers[i].pid)
+				kill(instance->helpers[i].pid, SIGKILL);
+	pthread_mutex_unlock(&persistent.lock);
+
+	while ((instance = persistent.instances)) {
+		persistent.instances = instance->next;
+		for (i = 0; i < instance->nhelpers; i++) {
+			helper = &instance->helpers[i];
+			if (helper->joinable)
+				pthread_join(helper->thread, NULL);
+			pthread_mutex_destroy(&helper->send_lock);
+		}
+		for (p = instance->command; *p; p++)
+			free(*p);
+		free(instance->command);
+		free(instance);
+	}
+}
+
 static void
 send_stdin(netresolve_query_t query, struct priv_exec *priv)
 {
@@ -109,6 +482,8 @@ received_line(netresolve_query_t query, struct priv_exec *priv, const char *line
 	int addrprefixlen = strlen(addrprefix);
 	char pathprefix[] = "path ";
 	int pathprefixlen = strlen(pathprefix);
+	char unixprefix[] = "unix ";
+	int unixprefixlen = strlen(unixprefix);
 	Address address;
 	int family;
 	int ifindex;
@@ -116,7 +491,7 @@ received_line(netresolve_query_t query, struct priv_exec *priv, const char *line
 	int protocol;
 	int port;
 
-	debug("received: %s", priv->outbuf.buffer);
+	debug("received: %s", line);
 
 	if (!*line)
 		return true;
@@ -129,7 +504,9 @@ received_line(netresolve_query_t query, struct priv_exec *priv, const char *line
 		if (netresolve_backend_parse_path(line + pathprefixlen,
 					&address, &family, &ifindex, &socktype, &protocol, &port))
 			netresolve_backend_add_path(query, family, &address, ifindex, socktype, protocol, port, 0, 0, 0);
-	}
+	} else if (!strncmp(unixprefix, line, unixprefixlen))
+		netresolve_backend_add_path(query, AF_UNIX, line + unixprefixlen, 0,
+				netresolve_backend_get_socktype(query), 0, 0, 0, 0, 0);
 
 	return false;
 }
@@ -172,20 +549,75 @@ pickup_stdout(netresolve_query_t query, struct priv_exec *priv)
 	}
 }
 
+static bool
+is_persistent(char **settings)
+{
+	return *settings && (!strcmp(*settings, "persistent") || !strncmp(*settings, "persistent=", 11));
+}
+
+static void
+pickup_response(netresolve_query_t query, struct priv_exec *priv)
+{
+	struct request *request = priv->request;
+	char *line, *nl;
+	bool finished;
+	uint64_t value;
+
+	if (read(request->fd, &value, sizeof value) != sizeof value)
+		return;
+
+	pthread_mutex_lock(&persistent.lock);
+	finished = request->finished;
+	pthread_mutex_unlock(&persistent.lock);
+
+	if (!finished)
+		return;
+	if (request->failed) {
+		error("exec: incomplete response");
+		netresolve_backend_failed(query);
+		return;
+	}
+
+	for (line = request->data; line && (nl = strchr(line, '\n')); line = nl + 1) {
+		*nl = '\0';
+		received_line(query, priv, line);
+	}
+	netresolve_backend_finished(query);
+}
+
 void
 setup_forward(netresolve_query_t query, char **settings)
 {
 	struct priv_exec *priv = netresolve_backend_new_priv(query, sizeof *priv);
+	const char *string;
+
+	if (!priv) {
+		netresolve_backend_failed(query);
+		return;
+	}
 
 	priv->infd = -1;
 	priv->outfd = -1;
 
-	if (!priv || !start_subprocess(settings, &priv->pid, &priv->infd, &priv->outfd)) {
+	if (is_persistent(settings)) {
+		if (!(priv->request = submit_request(query, settings))) {
+			netresolve_backend_failed(query);
+			return;
+		}
+		netresolve_backend_watch_fd(query, priv->request->fd, POLLIN);
+		return;
+	}
+
+	if (!(string = netresolve_get_request_string(query)) || !(priv->inbuf.buffer = strdup(string))) {
+		netresolve_backend_failed(query);
+		return;
+	}
+
+	if (!start_subprocess(settings, &priv->pid, &priv->infd, &priv->outfd)) {
 		netresolve_backend_failed(query);
 		return;
 	}
 
-	priv->inbuf.buffer = strdup(netresolve_get_request_string(query));
 	priv->inbuf.start = priv->inbuf.buffer;
 	priv->inbuf.end = priv->inbuf.buffer + strlen(priv->inbuf.buffer);
 
@@ -200,7 +632,9 @@ dispatch(netresolve_query_t query, int fd, int events)
 
 	debug("exec: events %d on fd %d", events, fd);
 
-	if (fd == priv->infd && events & POLLOUT)
+	if (priv->request && fd == priv->request->fd)
+		pickup_response(query, priv);
+	else if (fd == priv->infd && events & POLLOUT)
 		send_stdin(query, priv);
 	else if (fd == priv->outfd && events & POLLIN) {
 		pickup_stdout(query, priv);
@@ -218,6 +652,12 @@ cleanup(netresolve_query_t query)
 {
 	struct priv_exec *priv = netresolve_backend_get_priv(query);
 
+	if (priv->request) {
+		netresolve_backend_unwatch_fd(query, priv->request->fd);
+		cancel_request(priv->request);
+		return;
+	}
+
 	if (priv->infd != -1) {
 		netresolve_backend_unwatch_fd(query, priv->infd);
 		close(priv->infd);
@@ -227,7 +667,8 @@ cleanup(netresolve_query_t query)
 		close(priv->outfd);
 	}
 	/* TODO: Implement proper child handling. */
-	kill(priv->pid, SIGKILL);
+	if (priv->pid)
+		kill(priv->pid, SIGKILL);
 	free(priv->inbuf.buffer);
 	free(priv->outbuf.buffer);
 }
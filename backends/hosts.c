@@ -143,6 +143,8 @@ out:
 	list->items = realloc(list->items, list->reserved * sizeof *list->items);
 }
 
+const bool blocking = true;
+
 void
 setup_forward(netresolve_query_t query, char **settings)
 {
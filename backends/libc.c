@@ -26,6 +26,8 @@
 
 #define SIZE 16 * 1024
 
+const bool blocking = true;
+
 void
 setup_forward(netresolve_query_t query, char **settings)
 {
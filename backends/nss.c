@@ -25,13 +25,22 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <dlfcn.h>
+#include <errno.h>
+#include <pthread.h>
 
-#define SIZE (128*1024)
+/* NSS modules are loaded on first use and kept until the backend itself is
+ * unloaded. Buffers passed to the modules are kept per thread and grown
+ * when a module asks for more space using `ERANGE`.
+ */
+#define INITIAL_BUFFER_SIZE 1024
+#define MAX_BUFFER_SIZE (16*1024*1024)
 
-struct priv_nss {
+struct nss_module {
+	struct nss_module *next;
+	char *settings;
 	char *name;
 	char *filename;
-	const char *api;
+	char *api;
 	void *dl_handle;
 	/* gethostbyname:
 	 *
@@ -79,6 +88,19 @@ struct priv_nss {
 		int32_t *ttlp);
 };
 
+struct buffer {
+	char *data;
+	size_t size;
+};
+
+static struct {
+	pthread_mutex_t lock;
+	struct nss_module *modules;
+	pthread_once_t once;
+	pthread_key_t key;
+	bool key_created;
+} nss = { PTHREAD_MUTEX_INITIALIZER, NULL, PTHREAD_ONCE_INIT };
+
 static int
 combine_statuses(int s4, int s6)
 {
@@ -100,7 +122,7 @@ combine_statuses(int s4, int s6)
 }
 
 static void
-try_symbol_pattern(netresolve_query_t query, struct priv_nss *priv, void **f, const char *pattern, const char *api)
+try_symbol_pattern(struct nss_module *priv, void **f, const char *pattern, const char *api)
 {
 	char symbol[1024] = { 0 };
 
@@ -116,20 +138,20 @@ try_symbol_pattern(netresolve_query_t query, struct priv_nss *priv, void **f, co
 		debug("not loaded %s (%s): %s", symbol, api, dlerror());
 }
 
-static void
-initialize(struct priv_nss *priv, netresolve_query_t query, char **settings)
+static struct nss_module *
+initialize(char **settings)
 {
+	struct nss_module *priv;
 	char *p;
 
-	if (!settings || !*settings) {
-		error("missing argument");
-		return;
-	}
+	if (!(priv = calloc(1, sizeof *priv)))
+		return NULL;
 
 	/* parse settings */
+	priv->settings = strdup(*settings);
 	priv->name = strdup(*settings++);
 	if (*settings)
-		priv->api = *settings++;
+		priv->api = strdup(*settings++);
 	if ((p = strrchr(priv->name, '/'))) {
 		priv->filename = strdup(priv->name);
 		p++;
@@ -145,58 +167,172 @@ initialize(struct priv_nss *priv, netresolve_query_t query, char **settings)
 
 	/* load nsswitch module */
 	debug("loading NSS module: %s", priv->filename);
-	priv->dl_handle = dlopen(priv->filename, RTLD_LAZY);
+	priv->dl_handle = priv->filename ? dlopen(priv->filename, RTLD_LAZY) : NULL;
 	if (!priv->dl_handle) {
 		error("%s", dlerror());
-		return;
+		return priv;
 	}
 
 	/* find nsswitch entry points */
-	try_symbol_pattern(query, priv, (void *) &priv->gethostbyname_r, "_nss_%s_gethostbyname_r", "gethostbyname");
-	try_symbol_pattern(query, priv, (void *) &priv->gethostbyname2_r, "_nss_%s_gethostbyname2_r", "gethostbyname2");
-	try_symbol_pattern(query, priv, (void *) &priv->gethostbyname3_r, "_nss_%s_gethostbyname3_r", "gethostbyname3");
-	try_symbol_pattern(query, priv, (void *) &priv->gethostbyname4_r, "_nss_%s_gethostbyname4_r", "gethostbyname4");
-	try_symbol_pattern(query, priv, (void *) &priv->getaddrinfo, "_nss_%s_getaddrinfo", "getaddrinfo");
-
-	free(priv->name);
-	priv->name = NULL;
-	free(priv->filename);
-	priv->filename = NULL;
+	try_symbol_pattern(priv, (void *) &priv->gethostbyname_r, "_nss_%s_gethostbyname_r", "gethostbyname");
+	try_symbol_pattern(priv, (void *) &priv->gethostbyname2_r, "_nss_%s_gethostbyname2_r", "gethostbyname2");
+	try_symbol_pattern(priv, (void *) &priv->gethostbyname3_r, "_nss_%s_gethostbyname3_r", "gethostbyname3");
+	try_symbol_pattern(priv, (void *) &priv->gethostbyname4_r, "_nss_%s_gethostbyname4_r", "gethostbyname4");
+	try_symbol_pattern(priv, (void *) &priv->getaddrinfo, "_nss_%s_getaddrinfo", "getaddrinfo");
+
+	return priv;
+}
+
+/* get_module:
+ *
+ * Return the NSS module for the backend settings, loading it the first time.
+ * A module that fails to load is remembered as well, so that it's not
+ * retried for every query.
+ */
+static struct nss_module *
+get_module(char **settings)
+{
+	struct nss_module *priv;
+	const char *api = settings && *settings ? settings[1] : NULL;
+
+	if (!settings || !*settings) {
+		error("missing argument");
+		return NULL;
+	}
+
+	pthread_mutex_lock(&nss.lock);
+
+	for (priv = nss.modules; priv; priv = priv->next)
+		if (!strcmp(priv->settings, *settings) && (api ? priv->api && !strcmp(priv->api, api) : !priv->api))
+			break;
+
+	if (!priv && (priv = initialize(settings))) {
+		priv->next = nss.modules;
+		nss.modules = priv;
+	}
+
+	pthread_mutex_unlock(&nss.lock);
+
+	return priv;
 }
 
 static void
-finalize(struct priv_nss *priv)
+free_buffers(void *data)
+{
+	struct buffer *buffers = data;
+
+	if (!buffers)
+		return;
+	free(buffers[0].data);
+	free(buffers[1].data);
+	free(buffers);
+}
+
+static void
+create_key(void)
+{
+	nss.key_created = !pthread_key_create(&nss.key, free_buffers);
+}
+
+/* get_buffer:
+ *
+ * Return one of the two buffers of the calling thread, two are needed to
+ * keep both IPv4 and IPv6 results of gethostbyname2/3.
+ */
+static struct buffer *
+get_buffer(int index)
+{
+	struct buffer *buffers;
+
+	pthread_once(&nss.once, create_key);
+	if (!nss.key_created)
+		return NULL;
+
+	if (!(buffers = pthread_getspecific(nss.key))) {
+		if (!(buffers = calloc(2, sizeof *buffers)))
+			return NULL;
+		pthread_setspecific(nss.key, buffers);
+	}
+
+	if (!buffers[index].data) {
+		if (!(buffers[index].data = malloc(INITIAL_BUFFER_SIZE)))
+			return NULL;
+		buffers[index].size = INITIAL_BUFFER_SIZE;
+	}
+
+	return &buffers[index];
+}
+
+static bool
+grow_buffer(struct buffer *buffer)
 {
-	dlclose(priv->dl_handle);
+	char *data;
+
+	if (buffer->size >= MAX_BUFFER_SIZE)
+		return false;
+	if (!(data = realloc(buffer->data, buffer->size * 2)))
+		return false;
+
+	buffer->data = data;
+	buffer->size *= 2;
+
+	debug("NSS buffer grown to %zu bytes", buffer->size);
+
+	return true;
 }
 
+static void __attribute__((destructor))
+finalize(void)
+{
+	struct nss_module *priv;
+
+	while ((priv = nss.modules)) {
+		nss.modules = priv->next;
+		if (priv->dl_handle)
+			dlclose(priv->dl_handle);
+		free(priv->settings);
+		free(priv->name);
+		free(priv->filename);
+		free(priv->api);
+		free(priv);
+	}
+
+	/* Deleting the key keeps other threads from calling into the unloaded
+	 * backend on exit, at the cost of leaking their buffers.
+	 */
+	if (nss.key_created) {
+		free_buffers(pthread_getspecific(nss.key));
+		pthread_key_delete(nss.key);
+	}
+}
+
+const bool blocking = true;
+
 void
 setup_forward(netresolve_query_t query, char **settings)
 {
 	const char *node = netresolve_backend_get_nodename(query);
 	int family = netresolve_backend_get_family(query);
-	struct priv_nss priv = { 0 };
-
-	initialize(&priv, query, settings);
+	struct nss_module *priv = get_module(settings);
 
-	if (!priv.dl_handle) {
+	if (!priv || !priv->dl_handle) {
 		netresolve_backend_failed(query);
 		return;
 	}
 
-	if (priv.getaddrinfo) {
+	if (priv->getaddrinfo) {
 		const char *service = netresolve_backend_get_servname(query);
 		struct addrinfo hints = netresolve_backend_get_addrinfo_hints(query);
 		int status;
 		struct addrinfo *result;
 		int32_t ttl;
 
-		status = DL_CALL_FCT(priv.getaddrinfo, (node, service, &hints, &result, &ttl));
+		status = DL_CALL_FCT(priv->getaddrinfo, (node, service, &hints, &result, &ttl));
 		netresolve_backend_apply_addrinfo(query, status, result, ttl);
 		if (status == 0)
 			freeaddrinfo(result);
-	} else if (node && priv.gethostbyname4_r && family == AF_UNSPEC) {
-		char buffer[SIZE] = { 0 };
+	} else if (node && priv->gethostbyname4_r && family == AF_UNSPEC) {
+		struct buffer *buffer = get_buffer(0);
 		enum nss_status status;
 		/* The libnss_files.so plugin checks the gaih_addrtuple pointer for being
 		 * NULL and fails badly otherwise. Whether such behavior is correct
@@ -224,12 +360,20 @@ setup_forward(netresolve_query_t query, char **settings)
 		} _res_hconf;
 		_res_hconf.flags = 0x10;
 
-		status = DL_CALL_FCT(priv.gethostbyname4_r, (node, &result,
-			buffer, sizeof buffer, &errnop, &h_errnop, &ttl));
+		if (!buffer) {
+			netresolve_backend_failed(query);
+			return;
+		}
+
+		do {
+			result = NULL;
+			status = DL_CALL_FCT(priv->gethostbyname4_r, (node, &result,
+				buffer->data, buffer->size, &errnop, &h_errnop, &ttl));
+		} while (status == NSS_STATUS_TRYAGAIN && errnop == ERANGE && grow_buffer(buffer));
 		netresolve_backend_apply_addrtuple(query, status, result, ttl);
-	} else if (node && (priv.gethostbyname3_r || priv.gethostbyname2_r)) {
-		char buffer4[SIZE] = { 0 };
-		char buffer6[SIZE] = { 0 };
+	} else if (node && (priv->gethostbyname3_r || priv->gethostbyname2_r)) {
+		struct buffer *buffer4 = get_buffer(0);
+		struct buffer *buffer6 = get_buffer(1);
 		int status4 = NSS_STATUS_NOTFOUND, status6 = NSS_STATUS_NOTFOUND;
 		struct hostent he4, he6;
 		int errnop, h_errnop;
@@ -238,20 +382,33 @@ setup_forward(netresolve_query_t query, char **settings)
 		char *canonname4 = NULL;
 		char *canonname6 = NULL;
 
-		if (priv.gethostbyname3_r) {
+		if (!buffer4 || !buffer6) {
+			netresolve_backend_failed(query);
+			return;
+		}
+
+		if (priv->gethostbyname3_r) {
 			if (family == AF_INET || family == AF_UNSPEC)
-				status4 = DL_CALL_FCT(priv.gethostbyname3_r, (node, AF_INET,
-					&he4, buffer4, sizeof buffer4, &errnop, &h_errnop, &ttl4, &canonname4));
+				do {
+					status4 = DL_CALL_FCT(priv->gethostbyname3_r, (node, AF_INET,
+						&he4, buffer4->data, buffer4->size, &errnop, &h_errnop, &ttl4, &canonname4));
+				} while (status4 == NSS_STATUS_TRYAGAIN && errnop == ERANGE && grow_buffer(buffer4));
 			if (family == AF_INET6 || family == AF_UNSPEC)
-				status6 = DL_CALL_FCT(priv.gethostbyname3_r, (node, AF_INET6,
-					&he6, buffer6, sizeof buffer6, &errnop, &h_errnop, &ttl6, &canonname6));
+				do {
+					status6 = DL_CALL_FCT(priv->gethostbyname3_r, (node, AF_INET6,
+						&he6, buffer6->data, buffer6->size, &errnop, &h_errnop, &ttl6, &canonname6));
+				} while (status6 == NSS_STATUS_TRYAGAIN && errnop == ERANGE && grow_buffer(buffer6));
 		} else {
 			if (family == AF_INET || family == AF_UNSPEC)
-				status4 = DL_CALL_FCT(priv.gethostbyname2_r, (node, AF_INET,
-					&he4, buffer4, sizeof buffer4, &errnop, &h_errnop));
+				do {
+					status4 = DL_CALL_FCT(priv->gethostbyname2_r, (node, AF_INET,
+						&he4, buffer4->data, buffer4->size, &errnop, &h_errnop));
+				} while (status4 == NSS_STATUS_TRYAGAIN && errnop == ERANGE && grow_buffer(buffer4));
 			if (family == AF_INET6 || family == AF_UNSPEC)
-				status6 = DL_CALL_FCT(priv.gethostbyname2_r, (node, AF_INET6,
-					&he6, buffer6, sizeof buffer6, &errnop, &h_errnop));
+				do {
+					status6 = DL_CALL_FCT(priv->gethostbyname2_r, (node, AF_INET6,
+						&he6, buffer6->data, buffer6->size, &errnop, &h_errnop));
+				} while (status6 == NSS_STATUS_TRYAGAIN && errnop == ERANGE && grow_buffer(buffer6));
 		}
 
 		if (combine_statuses(status4, status6) == NSS_STATUS_SUCCESS) {
@@ -266,14 +423,21 @@ setup_forward(netresolve_query_t query, char **settings)
 			netresolve_backend_finished(query);
 		} else
 			netresolve_backend_failed(query);
-	} else if (node && priv.gethostbyname_r) {
-		char buffer[SIZE];
+	} else if (node && priv->gethostbyname_r) {
+		struct buffer *buffer = get_buffer(0);
 		int errnop, h_errnop;
 		struct hostent he;
 		enum nss_status status;
 
-		status = DL_CALL_FCT(priv.gethostbyname_r, (node,
-			&he, buffer, sizeof buffer, &errnop, &h_errnop));
+		if (!buffer) {
+			netresolve_backend_failed(query);
+			return;
+		}
+
+		do {
+			status = DL_CALL_FCT(priv->gethostbyname_r, (node,
+				&he, buffer->data, buffer->size, &errnop, &h_errnop));
+		} while (status == NSS_STATUS_TRYAGAIN && errnop == ERANGE && grow_buffer(buffer));
 
 		if (status == NSS_STATUS_SUCCESS) {
 			netresolve_backend_apply_hostent(query, &he, 0, 0, 0, 0, 0, 0);
@@ -284,6 +448,4 @@ setup_forward(netresolve_query_t query, char **settings)
 		debug("no suitable backend found");
 		netresolve_backend_failed(query);
 	}
-
-	finalize(&priv);
 }
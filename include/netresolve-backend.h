@@ -98,9 +98,19 @@ void netresolve_backend_remove_timeout(netresolve_query_t query, int fd);
 void netresolve_backend_finished(netresolve_query_t query);
 void netresolve_backend_failed(netresolve_query_t query);
 
-/* Logging */
-#define error(...) netresolve_log(0x20, __VA_ARGS__)
-#define debug(...) netresolve_log(0x40, __VA_ARGS__)
+/* Logging
+ *
+ * The level is checked before the arguments are evaluated so that disabled
+ * messages only cost a single branch.
+ */
+extern int netresolve_log_threshold;
+#define netresolve_log_enabled(level) __builtin_expect((level) <= netresolve_log_threshold, 0)
+#define netresolve_log_at(level, ...) do { \
+		if (netresolve_log_enabled(level)) \
+			netresolve_log(level, __VA_ARGS__); \
+	} while (0)
+#define error(...) netresolve_log_at(0x20, __VA_ARGS__)
+#define debug(...) netresolve_log_at(0x40, __VA_ARGS__)
 void netresolve_log(int level, const char *fmt, ...);
 
 /* Convenience */
@@ -111,6 +121,20 @@ bool netresolve_backend_parse_path(const char *str,
 		Address *address, int *family, int *ifindex,
 		int *socktype, int *protocol, int *port);
 
+/* Backends built into libnetresolve get their entry points prefixed, see
+ * `lib/builtin.c`. The prefix is passed as `NETRESOLVE_BUILTIN`.
+ */
+#ifdef NETRESOLVE_BUILTIN
+#define NETRESOLVE_BUILTIN_SYMBOL(prefix, symbol) NETRESOLVE_BUILTIN_SYMBOL_(prefix, symbol)
+#define NETRESOLVE_BUILTIN_SYMBOL_(prefix, symbol) prefix##_##symbol
+#define setup_forward NETRESOLVE_BUILTIN_SYMBOL(NETRESOLVE_BUILTIN, setup_forward)
+#define setup_reverse NETRESOLVE_BUILTIN_SYMBOL(NETRESOLVE_BUILTIN, setup_reverse)
+#define setup_dns NETRESOLVE_BUILTIN_SYMBOL(NETRESOLVE_BUILTIN, setup_dns)
+#define dispatch NETRESOLVE_BUILTIN_SYMBOL(NETRESOLVE_BUILTIN, dispatch)
+#define cleanup NETRESOLVE_BUILTIN_SYMBOL(NETRESOLVE_BUILTIN, cleanup)
+#define blocking NETRESOLVE_BUILTIN_SYMBOL(NETRESOLVE_BUILTIN, blocking)
+#endif
+
 /* Backend function prototypes */
 void setup_forward(netresolve_query_t query, char **settings);
 void setup_reverse(netresolve_query_t query, char **settings);
@@ -118,6 +142,12 @@ void setup_dns(netresolve_query_t query, char **settings);
 void dispatch(netresolve_query_t query, int fd, int revents);
 void cleanup(netresolve_query_t query);
 
+/* Backends that do all their work synchronously in the setup functions
+ * define `blocking` to `true` so that the setup is run in a worker thread
+ * when netresolve is used in nonblocking mode.
+ */
+extern const bool blocking;
+
 /* String functions */
 const char *netresolve_get_request_string(netresolve_query_t query);
 const char *netresolve_get_path_string(netresolve_query_t query, int i);
@@ -28,8 +28,17 @@
 #include <netdb.h>
 
 /* Utility functions */
+struct netresolve_sockaddr {
+	struct sockaddr_storage sa;
+	socklen_t salen;
+	int socktype;
+	int protocol;
+	int32_t ttl;
+};
+
 const struct sockaddr *netresolve_query_get_sockaddr(const netresolve_query_t query, size_t idx,
 		socklen_t *salen, int *socktype, int *protocol, int32_t *ttl);
+const struct netresolve_sockaddr *netresolve_query_get_sockaddrs(const netresolve_query_t query, size_t *count);
 
 /* Functions resembling modern POSIX host/service resolution API */
 netresolve_query_t netresolve_query_getaddrinfo(netresolve_t context,
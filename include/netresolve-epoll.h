@@ -28,6 +28,7 @@
 #include <sys/epoll.h>
 
 netresolve_t netresolve_epoll_new(void);
+netresolve_t netresolve_epoll_new_threaded(void);
 int netresolve_epoll_fd(netresolve_t context);
 void netresolve_epoll_dispatch(netresolve_t context);
 
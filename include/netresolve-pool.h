@@ -0,0 +1,49 @@
+/* Copyright (c) 2013 Pavel Šimerda, Red Hat, Inc. (psimerda at redhat.com) and others
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef NETRESOLVE_POOL_H
+#define NETRESOLVE_POOL_H
+
+#include <netresolve.h>
+
+typedef struct netresolve_pool *netresolve_pool_t;
+
+netresolve_pool_t netresolve_pool_new(int nthreads);
+void netresolve_pool_free(netresolve_pool_t pool);
+
+void netresolve_pool_set_options(netresolve_pool_t pool, ...);
+
+bool netresolve_pool_query_forward(netresolve_pool_t pool,
+		const char *node, const char *service,
+		netresolve_query_callback callback, void *user_data);
+bool netresolve_pool_query_reverse(netresolve_pool_t pool,
+		int family, const void *address, int ifindex, int protocol, int port,
+		netresolve_query_callback callback, void *user_data);
+bool netresolve_pool_query_dns(netresolve_pool_t pool,
+		const char *dname, int cls, int type,
+		netresolve_query_callback callback, void *user_data);
+
+int netresolve_pool_fd(netresolve_pool_t pool);
+void netresolve_pool_dispatch(netresolve_pool_t pool);
+
+#endif /* NETRESOLVE_POOL_H */
@@ -33,12 +33,17 @@
 #include <stdio.h>
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <limits.h>
 #include <nss.h>
 #include <netdb.h>
 #include <net/if.h>
 #include <arpa/inet.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <assert.h>
+#include <pthread.h>
+#include <time.h>
 
 #define debug_context(context, format, ...) debug( \
 		"[context %p] " format, \
@@ -78,40 +83,61 @@ enum netresolve_security {
 struct netresolve_epoll {
 	int fd;
 	int count;
+	/* Multi-threaded dispatch, sources indexed by file descriptor */
+	struct netresolve_epoll_slot {
+		netresolve_source_t source;
+		uint32_t generation;
+	} *slots;
+	int nslots;
+	uint32_t generation;
 };
 
 struct netresolve_backend {
 	bool mandatory;
 	char **settings;
-	void *dl_handle;
+	const char *name;
+	int loaded;
+	struct netresolve_module *module;
 	void (*setup[_NETRSOLVE_REQUEST_TYPES])(netresolve_query_t query, char **settings);
 	void (*dispatch)(netresolve_query_t query, int fd, int revents);
 	void (*cleanup)(netresolve_query_t query);
-	void *data;
+	bool blocking;
 };
 
+/* Shared and immutable list of backends parsed from a backend string */
+struct netresolve_chain {
+	struct netresolve_chain *next;
+	char *string;
+	int refcount;
+	struct netresolve_backend **backends;
+};
+
+/* A path is kept in 32 bytes so that iterating over the results touches
+ * few cache lines. AF_UNIX paths are stored out of line, the record only
+ * holds their index in `response.unix_paths`. The narrow fields still hold
+ * every socket type and protocol known to Linux, including IPPROTO_MPTCP.
+ * Paths with values that don't fit are rejected by
+ * `netresolve_backend_add_path()`.
+ */
 struct netresolve_path {
 	struct {
-		int family;
 		union {
-			char address[1024];
+			char address[sizeof (struct in6_addr)];
 			struct in_addr address4;
 			struct in6_addr address6;
+			uint32_t unix_path;
 		};
-		int ifindex;
+		unsigned int ifindex : 24;
+		unsigned int family : 8;
 	} node;
 	struct {
-		int socktype;
-		int protocol;
-		int port;
+		unsigned int socktype : 4;
+		unsigned int protocol : 12;
+		unsigned int port : 16;
 	} service;
-	int priority;
-	int weight;
-	int ttl;
-	struct {
-		enum netresolve_state state;
-		int fd;
-	} socket;
+	uint16_t priority;
+	uint16_t weight;
+	int32_t ttl;
 };
 
 struct netresolve_query {
@@ -119,6 +145,7 @@ struct netresolve_query {
 	struct netresolve_source {
 		netresolve_query_t query;
 		int fd;
+		int events;
 		void *handle;
 		struct netresolve_source *previous, *next;
 	} sources;
@@ -129,7 +156,27 @@ struct netresolve_query {
 	int delayed_fd;
 	int timeout_fd;
 	int partial_timeout_fd;
+	/* Start of the current backend and arrival of its first path */
+	struct timespec started;
+	struct timespec partial;
+	struct netresolve_chain *chain;
 	struct netresolve_backend **backend;
+	void *priv;
+	/* Setup of a blocking backend running in a worker thread */
+	struct netresolve_offload *offload;
+	bool offloaded;
+	/* Speculative execution of the backend chain */
+	netresolve_query_t parent;
+	struct netresolve_speculation {
+		netresolve_query_t *children;
+		int count;
+		int cursor;
+		bool starting;
+	} speculation;
+	/* Multi-threaded dispatch */
+	pthread_mutex_t lock;
+	int refcount;
+	bool freed;
 	struct netresolve_request {
 		enum netresolve_request_type type;
 		/* Perform L3 address resolution using 'nodename' if not NULL. Use
@@ -151,10 +198,11 @@ struct netresolve_query {
 		bool default_loopback;
 		bool dns_srv_lookup;
 		bool dns_search;
+		bool addrconfig;
 		int clamp_ttl;
 		/* Reverse query */
 		union {
-			char address[1024];
+			char address[sizeof (struct in6_addr)];
 			struct in_addr address4;
 			struct in6_addr address6;
 		};
@@ -166,10 +214,24 @@ struct netresolve_query {
 		/* Timeout configuration */
 		int timeout;
 		int partial_timeout;
+		int connect_delay;
+		bool adaptive_timeouts;
+		int timeout_floor;
+		int partial_timeout_floor;
+		/* Incremental results */
+		netresolve_path_callback path_callback;
 	} request;
 	struct netresolve_response {
 		struct netresolve_path *paths;
 		size_t pathcount;
+		size_t pathcapacity;
+		/* Paths passed to `path_callback` so far */
+		size_t reported;
+		/* AF_UNIX socket paths referred to by the paths */
+		char **unix_paths;
+		size_t unix_pathcount;
+		/* Built on demand, see `netresolve_query_get_sockaddrs()` */
+		struct netresolve_sockaddr *sockaddrs;
 		char *nodename;
 		char *servname;
 		struct {
@@ -181,21 +243,33 @@ struct netresolve_query {
 
 	struct netresolve_service_list *services;
 
-	union {
-		struct sockaddr sa;
-		struct sockaddr_in sin;
-		struct sockaddr_in6 sin6;
-	} sa_buffer;
-	char buffer[1024];
+	/* Rarely used storage, see `netresolve_query_get_extra()` */
+	struct netresolve_query_extra {
+		char buffer[1024];
+	} *extra;
 	struct netresolve_query *previous, *next;
+	/* Strings of the request equal to those of the template are shared. */
+	struct netresolve_template *template;
+};
+
+/* Request prepared once and used for many queries */
+struct netresolve_template {
+	netresolve_t context;
+	int refcount;
+	struct netresolve_request request;
 };
 
+#define NETRESOLVE_BLOCK_CLASSES 5
+
 struct netresolve_context {
 	struct netresolve_query queries;
 	struct netresolve_request request;
 	struct netresolve_epoll epoll;
 	int nfds;
-	struct netresolve_backend **backends;
+	struct netresolve_chain *chain;
+	/* Multi-threaded dispatch, see `netresolve_epoll_new_threaded()` */
+	bool threaded;
+	pthread_mutex_t lock;
 	struct {
 		netresolve_watch_fd_callback_t watch_fd;
 		netresolve_unwatch_fd_callback_t unwatch_fd;
@@ -204,18 +278,88 @@ struct netresolve_context {
 	} callbacks;
 	struct netresolve_config {
 		int force_family;
+		bool offload;
+		bool speculative;
 	} config;
+	/* Source addresses for sorting, see `lib/sort.c` */
+	struct netresolve_source_cache *sources;
+	/* Connection history, see `lib/rtt.c` */
+	struct netresolve_rtt *rtt;
+	/* Backend latency history, see `lib/latency.c` */
+	struct netresolve_latency *latency;
+	/* Memory of released queries and backend data, see `lib/slab.c` */
+	struct {
+		struct netresolve_slab *slabs;
+		netresolve_query_t queries;
+		struct netresolve_block *blocks[NETRESOLVE_BLOCK_CLASSES];
+	} slab;
 };
 
 /* Query */
 netresolve_query_t netresolve_query(netresolve_t context, netresolve_query_callback callback, void *user_data,
 		enum netresolve_option type, ...);
+netresolve_query_t netresolve_query_new(netresolve_t context, enum netresolve_request_type type);
+void netresolve_query_setup(netresolve_query_t query);
 const char *netresolve_query_state_to_string(enum netresolve_state state);
 void netresolve_query_set_state(netresolve_query_t query, enum netresolve_state state);
 bool netresolve_query_dispatch(netresolve_query_t query, int fd, int events);
+void netresolve_query_lock(netresolve_query_t query);
+void netresolve_query_unlock(netresolve_query_t query);
+void netresolve_query_release(netresolve_query_t query);
+void netresolve_query_update(netresolve_query_t query);
+struct netresolve_query_extra *netresolve_query_get_extra(netresolve_query_t query);
+
+/* Slab */
+netresolve_query_t netresolve_slab_alloc_query(netresolve_t context);
+void netresolve_slab_free_query(netresolve_query_t query);
+void *netresolve_slab_alloc_priv(netresolve_t context, size_t size);
+void netresolve_slab_free_priv(netresolve_t context, void *priv);
+void netresolve_slab_clear(netresolve_t context);
+
+/* Context */
+void netresolve_context_lock(netresolve_t context);
+void netresolve_context_unlock(netresolve_t context);
+
+/* Sorting */
+void netresolve_sort_paths(netresolve_query_t query);
+int netresolve_sort_addrconfig(netresolve_t context);
+void netresolve_sort_clear(netresolve_t context);
+
+/* Connection history */
+#define NETRESOLVE_RTT_UNKNOWN (LONG_MAX - 1)
+#define NETRESOLVE_RTT_FAILED LONG_MAX
+void netresolve_rtt_update(netresolve_t context, const struct sockaddr *sa, long rtt);
+long netresolve_rtt_get_cost(netresolve_t context, const struct sockaddr *sa);
+
+/* Backend latency */
+enum netresolve_latency_type {
+	NETRESOLVE_LATENCY_TOTAL,
+	NETRESOLVE_LATENCY_PARTIAL,
+	_NETRESOLVE_LATENCY_TYPES
+};
+void netresolve_latency_record(netresolve_query_t query, enum netresolve_latency_type type, const struct timespec *since);
+int netresolve_latency_get_timeout(netresolve_query_t query, enum netresolve_latency_type type);
+
+/* Backend */
+struct netresolve_builtin {
+	const char *name;
+	void (*setup[_NETRSOLVE_REQUEST_TYPES])(netresolve_query_t query, char **settings);
+	void (*dispatch)(netresolve_query_t query, int fd, int revents);
+	void (*cleanup)(netresolve_query_t query);
+	const bool *blocking;
+};
+const struct netresolve_builtin *netresolve_builtin_lookup(const char *name);
+struct netresolve_chain *netresolve_chain_get(const char *string);
+struct netresolve_chain *netresolve_chain_ref(struct netresolve_chain *chain);
+void netresolve_chain_unref(struct netresolve_chain *chain);
+bool netresolve_module_load(struct netresolve_backend *backend);
+void netresolve_backend_merge_response(netresolve_query_t query, netresolve_query_t source);
+void netresolve_backend_free_unix_paths(struct netresolve_response *response);
 
 /* Request */
 bool netresolve_request_set_options_from_va(struct netresolve_request *request, va_list ap);
+struct netresolve_template *netresolve_template_ref(struct netresolve_template *template);
+void netresolve_template_unref(struct netresolve_template *template);
 bool netresolve_request_get_options_from_va(struct netresolve_request *request, va_list ap);
 
 /* Event handling */
@@ -239,13 +383,48 @@ int netresolve_family_from_string(const char *str);
 int netresolve_socktype_from_string(const char *str);
 int netresolve_protocol_from_string(const char *str);
 
+/* Logging */
+enum netresolve_log_level netresolve_get_log_level(void);
+
+/* Tracing */
+enum netresolve_trace_event {
+	NETRESOLVE_TRACE_STATE,
+	NETRESOLVE_TRACE_WATCH,
+	NETRESOLVE_TRACE_UNWATCH,
+	NETRESOLVE_TRACE_DISPATCH
+};
+
+extern bool netresolve_trace_enabled;
+#define netresolve_trace(query, event, value) do { \
+		if (__builtin_expect(netresolve_trace_enabled, 0)) \
+			netresolve_trace_record(query, event, value); \
+	} while (0)
+void netresolve_trace_record(netresolve_query_t query, enum netresolve_trace_event event, int value);
+
 /* String output */
 const char *netresolve_get_request_string(netresolve_query_t query);
 const char *netresolve_get_path_string(netresolve_query_t query, int i);
 const char *netresolve_get_response_string(netresolve_query_t query);
 
+/* Blocking backends */
+bool netresolve_offload_setup(netresolve_query_t query);
+bool netresolve_offload_dispatch(netresolve_query_t query, int fd);
+void netresolve_offload_cancel(netresolve_query_t query);
+
+/* Speculative execution */
+bool netresolve_speculation_start(netresolve_query_t query);
+void netresolve_speculation_notify(netresolve_query_t child);
+void netresolve_speculation_cancel(netresolve_query_t query);
+
 /* Socket */
 bool netresolve_connect_dispatch(netresolve_query_t query, int fd, int events);
+void netresolve_connect_update(netresolve_query_t query);
+netresolve_query_t netresolve_connect_start(netresolve_t context,
+		const char *nodename, const char *servname,
+		int family, int socktype, int protocol,
+		const void *payload, size_t size,
+		netresolve_socket_callback_t callback, void *user_data, bool report_failure);
+void netresolve_connect_cancel(netresolve_query_t query);
 
 /* Event loop for blocking mode */
 bool netresolve_epoll_install(netresolve_t context,
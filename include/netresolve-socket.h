@@ -27,14 +27,40 @@
 #include <netresolve.h>
 
 typedef void (*netresolve_socket_callback_t)(netresolve_query_t query, int idx, int sock, void *user_data);
+typedef void (*netresolve_socket_set_callback_t)(netresolve_query_t query, int idx, const int *socks, int count, void *user_data);
 
 netresolve_query_t netresolve_connect(netresolve_t context,
 		const char *nodename, const char *servname,
 		int family, int socktype, int protocol,
 		netresolve_socket_callback_t callback, void *user_data);
+netresolve_query_t netresolve_connect_with_data(netresolve_t context,
+		const char *nodename, const char *servname,
+		int family, int socktype, int protocol,
+		const void *payload, size_t size,
+		netresolve_socket_callback_t callback, void *user_data);
+size_t netresolve_connect_get_sent(netresolve_query_t query);
+netresolve_query_t netresolve_connect_all(netresolve_t context,
+		const char *nodename, const char *servname,
+		int family, int socktype, int protocol,
+		int limit, int timeout,
+		netresolve_socket_callback_t callback, void *user_data);
 netresolve_query_t netresolve_bind(netresolve_t context,
 		const char *nodename, const char *servname,
 		int family, int socktype, int protocol,
 		netresolve_socket_callback_t callback, void *user_data);
+netresolve_query_t netresolve_bind_set(netresolve_t context,
+		const char *nodename, const char *servname,
+		int family, int socktype, int protocol,
+		int count, bool per_cpu,
+		netresolve_socket_set_callback_t callback, void *user_data);
+
+typedef struct netresolve_socket_pool *netresolve_socket_pool_t;
+
+netresolve_socket_pool_t netresolve_socket_pool_new(netresolve_t context, int size);
+void netresolve_socket_pool_free(netresolve_socket_pool_t pool);
+bool netresolve_socket_pool_connect(netresolve_socket_pool_t pool,
+		const char *nodename, const char *servname,
+		int family, int socktype, int protocol,
+		netresolve_socket_callback_t callback, void *user_data);
 
 #endif /* NETRESOLVE_SOCKET_H */
@@ -30,6 +30,7 @@
 
 typedef struct netresolve_context *netresolve_t;
 typedef struct netresolve_query *netresolve_query_t;
+typedef struct netresolve_template *netresolve_request_t;
 
 /* Configuration options */
 enum netresolve_option {
@@ -41,9 +42,14 @@ enum netresolve_option {
  *    to an empty address. The opposite of getaddrinfo's AI_PASSIVE.
  * NETRESOLVE_OPTION_DNS_SRV_LOOKUP:
  *  - When set, forward lookups use DNS SRV records when applicable.
+ * NETRESOLVE_OPTION_ADDRCONFIG:
+ *  - When set, forward lookups with unspecified family only look for
+ *    addresses of the family the host can use, like getaddrinfo's
+ *    AI_ADDRCONFIG.
  */
 	NETRESOLVE_OPTION_DEFAULT_LOOPBACK = 0x10, /* bool default_loopback */
 	NETRESOLVE_OPTION_DNS_SRV_LOOKUP, /* bool dns_srv_lookup */
+	NETRESOLVE_OPTION_ADDRCONFIG, /* bool addrconfig */
 /* Node and service name:
  *
  * You don't normally need to set them as they are specified as parameters
@@ -76,6 +82,13 @@ enum netresolve_option {
 	NETRESOLVE_OPTION_DNS_NAME = 0x300, /* const char *dname */
 	NETRESOLVE_OPTION_DNS_CLASS, /* int class */
 	NETRESOLVE_OPTION_DNS_TYPE, /* int type */
+/* Incremental results:
+ *
+ * NETRESOLVE_OPTION_PATH_CALLBACK:
+ *  - Called with the index of each path that arrives while the query
+ *    is still waiting for more, with the user data of the query.
+ */
+	NETRESOLVE_OPTION_PATH_CALLBACK = 0x400, /* netresolve_path_callback callback */
 };
 
 /* Context construction and destruction */
@@ -88,6 +101,7 @@ void netresolve_context_set_options(netresolve_t context, ...);
 
 /* Query construction and destruction */
 typedef void (*netresolve_query_callback)(netresolve_query_t query, void *user_data);
+typedef void (*netresolve_path_callback)(netresolve_query_t query, size_t idx, void *user_data);
 
 netresolve_query_t netresolve_query_forward(netresolve_t context,
 		const char *node, const char *service,
@@ -100,6 +114,13 @@ netresolve_query_t netresolve_query_dns(netresolve_t context,
 		netresolve_query_callback callback, void *user_data);
 void netresolve_query_free(netresolve_query_t query);
 
+/* Reusable requests */
+netresolve_request_t netresolve_request_new(netresolve_t context, ...);
+void netresolve_request_free(netresolve_request_t request);
+netresolve_query_t netresolve_request_forward(netresolve_request_t request,
+		const char *node, const char *service,
+		netresolve_query_callback callback, void *user_data);
+
 /* Query result getters (forward queries) */
 size_t netresolve_query_get_count(const netresolve_query_t query);
 void netresolve_query_get_node_info(const netresolve_query_t query, size_t idx,
@@ -130,4 +151,8 @@ enum netresolve_log_level {
 };
 void netresolve_set_log_level(enum netresolve_log_level level);
 
+/* Tracing */
+void netresolve_set_trace(bool enabled);
+void netresolve_trace_dump(int fd);
+
 #endif /* NETRESOLVE_H */
@@ -130,36 +130,115 @@ family_to_length(int family)
 	}
 }
 
+static void
+insert_path(netresolve_query_t query, const struct netresolve_path *path)
+{
+	struct netresolve_response *response = &query->response;
+
+	if (response->pathcount == response->pathcapacity) {
+		size_t capacity = response->pathcapacity ? 2 * response->pathcapacity : 4;
+		struct netresolve_path *paths = realloc(response->paths, capacity * sizeof *paths);
+
+		if (!paths)
+			return;
+		response->paths = paths;
+		response->pathcapacity = capacity;
+	}
+
+	response->paths[response->pathcount++] = *path;
+	free(response->sockaddrs);
+	response->sockaddrs = NULL;
+
+	debug_query(query, "added path: %s", netresolve_get_path_string(query, response->pathcount - 1));
+}
+
+/* add_unix_path:
+ *
+ * Store an AF_UNIX socket path for the query and return its index. Paths
+ * added for several socket types share the same entry.
+ */
 static int
-path_cmp(const struct netresolve_path *p1, const struct netresolve_path *p2)
+add_unix_path(netresolve_query_t query, const char *unix_path)
 {
-	if (p1->node.family == AF_INET6 && p2->node.family == AF_INET)
+	struct netresolve_response *response = &query->response;
+	char **unix_paths;
+
+	if (response->unix_pathcount && !strcmp(response->unix_paths[response->unix_pathcount - 1], unix_path))
+		return response->unix_pathcount - 1;
+
+	if (!(unix_paths = realloc(response->unix_paths, (response->unix_pathcount + 1) * sizeof *unix_paths)))
+		return -1;
+	response->unix_paths = unix_paths;
+	if (!(unix_paths[response->unix_pathcount] = strdup(unix_path)))
 		return -1;
-	if (p1->node.family == AF_INET && p2->node.family == AF_INET6)
-		return 1;
 
-	return 0;
+	return response->unix_pathcount++;
+}
+
+void
+netresolve_backend_free_unix_paths(struct netresolve_response *response)
+{
+	size_t i;
+
+	for (i = 0; i < response->unix_pathcount; i++)
+		free(response->unix_paths[i]);
+	free(response->unix_paths);
+	response->unix_paths = NULL;
+	response->unix_pathcount = 0;
 }
 
 static void
 add_path(netresolve_query_t query, const struct netresolve_path *path)
 {
-	struct netresolve_response *response = &query->response;
+	insert_path(query, path);
+
+	if (query->state == NETRESOLVE_STATE_WAITING)
+		netresolve_query_set_state(query, NETRESOLVE_STATE_WAITING_MORE);
+	else if (query->state == NETRESOLVE_STATE_WAITING_MORE)
+		netresolve_query_update(query);
+}
+
+/* netresolve_backend_merge_response:
+ *
+ * Take over the response data gathered by a setup that ran on behalf of
+ * the query in a worker thread. The source query is left empty.
+ */
+void
+netresolve_backend_merge_response(netresolve_query_t query, netresolve_query_t source)
+{
+	struct netresolve_response *response = &source->response;
 	int i;
 
-	for (i = 0; i < response->pathcount; i++)
-		if (path_cmp(path, &response->paths[i]) < 0)
-			break;
+	for (i = 0; i < response->pathcount; i++) {
+		struct netresolve_path path = response->paths[i];
+		int unix_path;
 
-	response->paths = realloc(response->paths, (response->pathcount + 1) * sizeof *path);
-	memmove(&response->paths[i+1], &response->paths[i],
-			(response->pathcount++ - i) * sizeof *response->paths);
-	memcpy(&response->paths[i], path, sizeof *path);
+		if (path.node.family == AF_UNIX) {
+			if ((unix_path = add_unix_path(query, response->unix_paths[path.node.unix_path])) == -1)
+				continue;
+			path.node.unix_path = unix_path;
+		}
+		insert_path(query, &path);
+	}
+	free(response->paths);
+	netresolve_backend_free_unix_paths(response);
 
-	debug_query(query, "added path: %s", netresolve_get_path_string(query, response->pathcount - 1));
+	if (response->nodename) {
+		free(query->response.nodename);
+		query->response.nodename = response->nodename;
+	}
+	if (response->servname) {
+		free(query->response.servname);
+		query->response.servname = response->servname;
+	}
+	if (response->dns.answer) {
+		free(query->response.dns.answer);
+		query->response.dns = response->dns;
+	}
+	if (response->security > query->response.security)
+		query->response.security = response->security;
 
-	if (query->state == NETRESOLVE_STATE_WAITING)
-		netresolve_query_set_state(query, NETRESOLVE_STATE_WAITING_MORE);
+	memset(response, 0, sizeof *response);
 }
 
 struct path_data {
@@ -214,10 +293,25 @@ netresolve_backend_add_path(netresolve_query_t query,
 		.ttl = ttl
 	};
 
+	if (path.node.family != family || path.node.ifindex != ifindex
+			|| path.service.socktype != (socktype ? socktype : request->socktype)
+			|| path.service.protocol != (protocol ? protocol : request->protocol)
+			|| path.service.port != port
+			|| path.priority != priority || path.weight != weight) {
+		error("path out of range: family=%d ifindex=%d socktype=%d protocol=%d port=%d priority=%d weight=%d",
+				family, ifindex, socktype, protocol, port, priority, weight);
+		return;
+	}
+
 	if (length)
 		memcpy(path.node.address, address, length);
-	else
-		strncpy(path.node.address, address, sizeof path.node.address);
+	else if (family == AF_UNIX) {
+		int unix_path = add_unix_path(query, address);
+
+		if (unix_path == -1)
+			return;
+		path.node.unix_path = unix_path;
+	}
 
 	if (query->request.servname && (!socktype || !protocol || !port)) {
 		struct path_data data = { .query = query, .path = &path };
@@ -282,22 +376,25 @@ netresolve_backend_set_dns_answer(netresolve_query_t query, const void *answer,
 void *
 netresolve_backend_new_priv(netresolve_query_t query, size_t size)
 {
-	if ((*query->backend)->data) {
+	/* Setup running in a worker thread mustn't touch the context. */
+	netresolve_t context = query->offloaded ? NULL : query->context;
+
+	if (query->priv) {
 		error("Backend data already present.");
-		free((*query->backend)->data);
+		netresolve_slab_free_priv(context, query->priv);
 	}
 
-	(*query->backend)->data = calloc(1, size);
-	if (!(*query->backend)->data)
+	query->priv = netresolve_slab_alloc_priv(context, size);
+	if (!query->priv)
 		netresolve_backend_failed(query);
 
-	return (*query->backend)->data;
+	return query->priv;
 }
 
 void *
 netresolve_backend_get_priv(netresolve_query_t query)
 {
-	return (*query->backend)->data;
+	return query->priv;
 }
 
 void
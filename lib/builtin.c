@@ -0,0 +1,93 @@
+/* Copyright (c) 2013 Pavel Šimerda, Red Hat, Inc. (psimerda at redhat.com) and others
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <netresolve-private.h>
+
+/* Lightweight backends can be compiled into libnetresolve itself using
+ * `--enable-builtin-backends` to avoid the dynamic loader altogether. Their
+ * entry points are prefixed by the backend name and declared weak, so that
+ * the ones a backend doesn't provide resolve to NULL.
+ */
+#ifdef NETRESOLVE_BUILTIN_BACKENDS
+
+#define DECLARE_BUILTIN(name) \
+	__attribute__((weak)) void builtin_##name##_setup_forward(netresolve_query_t query, char **settings); \
+	__attribute__((weak)) void builtin_##name##_setup_reverse(netresolve_query_t query, char **settings); \
+	__attribute__((weak)) void builtin_##name##_setup_dns(netresolve_query_t query, char **settings); \
+	__attribute__((weak)) void builtin_##name##_dispatch(netresolve_query_t query, int fd, int revents); \
+	__attribute__((weak)) void builtin_##name##_cleanup(netresolve_query_t query); \
+	__attribute__((weak)) extern const bool builtin_##name##_blocking;
+
+#define BUILTIN(name) { \
+		#name, \
+		{ \
+			[NETRESOLVE_REQUEST_FORWARD] = builtin_##name##_setup_forward, \
+			[NETRESOLVE_REQUEST_REVERSE] = builtin_##name##_setup_reverse, \
+			[NETRESOLVE_REQUEST_DNS] = builtin_##name##_setup_dns, \
+		}, \
+		builtin_##name##_dispatch, \
+		builtin_##name##_cleanup, \
+		&builtin_##name##_blocking, \
+	}
+
+DECLARE_BUILTIN(unix)
+DECLARE_BUILTIN(any)
+DECLARE_BUILTIN(loopback)
+DECLARE_BUILTIN(numerichost)
+DECLARE_BUILTIN(hosts)
+DECLARE_BUILTIN(hostname)
+
+static const struct netresolve_builtin builtins[] = {
+	BUILTIN(unix),
+	BUILTIN(any),
+	BUILTIN(loopback),
+	BUILTIN(numerichost),
+	BUILTIN(hosts),
+	BUILTIN(hostname),
+	{ NULL }
+};
+
+#else
+
+static const struct netresolve_builtin builtins[] = {
+	{ NULL }
+};
+
+#endif
+
+/* netresolve_builtin_lookup:
+ *
+ * Find a backend compiled into the library. Returns NULL for backends
+ * that are to be loaded dynamically.
+ */
+const struct netresolve_builtin *
+netresolve_builtin_lookup(const char *name)
+{
+	const struct netresolve_builtin *builtin;
+
+	for (builtin = builtins; builtin->name; builtin++)
+		if (!strcmp(builtin->name, name))
+			return builtin;
+
+	return NULL;
+}
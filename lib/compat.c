@@ -21,53 +21,116 @@
  * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
+#include <stddef.h>
 #include <string.h>
 
 /* FIXME: Get rid of this. */
 #include <netresolve-private.h>
 
-/* netresolve_query_get_sockaddr:
- *
- * Retrieve the address information as `struct sockaddr` and a couple of
- * separate values typically used with the BSD socket API.
- */
-const struct sockaddr *
-netresolve_query_get_sockaddr(netresolve_query_t query, size_t idx,
-		socklen_t *salen, int *socktype, int *protocol, int32_t *ttl)
+static void
+fill_sockaddr(netresolve_query_t query, size_t idx, struct netresolve_sockaddr *entry)
 {
 	int family, ifindex, port;
 	const void *address;
 
 	netresolve_query_get_node_info(query, idx, &family, &address, &ifindex);
-	netresolve_query_get_service_info(query, idx, socktype, protocol, &port);
-	netresolve_query_get_aux_info(query, idx, NULL, NULL, ttl);
-
-	if (!address)
-		return NULL;
-
-	memset(&query->sa_buffer, 0, sizeof query->sa_buffer);
+	netresolve_query_get_service_info(query, idx, &entry->socktype, &entry->protocol, &port);
+	netresolve_query_get_aux_info(query, idx, NULL, NULL, &entry->ttl);
 
 	switch (family) {
 	case AF_INET:
-		query->sa_buffer.sin.sin_family = family;
-		query->sa_buffer.sin.sin_port = htons(port);
-		query->sa_buffer.sin.sin_addr = *(struct in_addr *) address;
-		if (salen)
-			*salen = sizeof query->sa_buffer.sin;
+		{
+			struct sockaddr_in *sin = (void *) &entry->sa;
+
+			sin->sin_family = family;
+			sin->sin_port = htons(port);
+			sin->sin_addr = *(struct in_addr *) address;
+			entry->salen = sizeof *sin;
+		}
 		break;
 	case AF_INET6:
-		query->sa_buffer.sin6.sin6_family = family;
-		query->sa_buffer.sin6.sin6_port = htons(port);
-		query->sa_buffer.sin6.sin6_scope_id = ifindex;
-		query->sa_buffer.sin6.sin6_addr = *(struct in6_addr *) address;
-		if (salen)
-			*salen = sizeof query->sa_buffer.sin6;
+		{
+			struct sockaddr_in6 *sin6 = (void *) &entry->sa;
+
+			sin6->sin6_family = family;
+			sin6->sin6_port = htons(port);
+			sin6->sin6_scope_id = ifindex;
+			sin6->sin6_addr = *(struct in6_addr *) address;
+			entry->salen = sizeof *sin6;
+		}
 		break;
-	default:
+	case AF_UNIX:
+		{
+			struct sockaddr_un *sun = (void *) &entry->sa;
+			size_t length = strnlen(address, sizeof sun->sun_path - 1);
+
+			sun->sun_family = family;
+			memcpy(sun->sun_path, address, length);
+			entry->salen = offsetof(struct sockaddr_un, sun_path) + length + 1;
+		}
+		break;
+	}
+}
+
+/* netresolve_query_get_sockaddrs:
+ *
+ * Retrieve all paths at once as an array of `struct netresolve_sockaddr`
+ * records ready to be passed to the BSD socket API. The array has one entry
+ * per path, built on first use and kept until the response changes or the
+ * query is freed. Entries of paths with no socket address representation
+ * have `salen` set to zero.
+ */
+const struct netresolve_sockaddr *
+netresolve_query_get_sockaddrs(netresolve_query_t query, size_t *count)
+{
+	struct netresolve_response *response = &query->response;
+	size_t idx;
+
+	*count = 0;
+
+	if (!response->pathcount)
 		return NULL;
+
+	if (!response->sockaddrs) {
+		if (!(response->sockaddrs = calloc(response->pathcount, sizeof *response->sockaddrs)))
+			return NULL;
+		for (idx = 0; idx < response->pathcount; idx++)
+			fill_sockaddr(query, idx, &response->sockaddrs[idx]);
 	}
 
-	return &query->sa_buffer.sa;
+	*count = response->pathcount;
+	return response->sockaddrs;
+}
+
+/* netresolve_query_get_sockaddr:
+ *
+ * Retrieve the address information as `struct sockaddr` and a couple of
+ * separate values typically used with the BSD socket API. The returned
+ * pointer stays valid under the same conditions as the array returned by
+ * `netresolve_query_get_sockaddrs()`.
+ */
+const struct sockaddr *
+netresolve_query_get_sockaddr(netresolve_query_t query, size_t idx,
+		socklen_t *salen, int *socktype, int *protocol, int32_t *ttl)
+{
+	size_t count;
+	const struct netresolve_sockaddr *sockaddrs = netresolve_query_get_sockaddrs(query, &count);
+	const struct netresolve_sockaddr *entry;
+
+	if (idx >= count || !sockaddrs[idx].salen)
+		return NULL;
+
+	entry = &sockaddrs[idx];
+	if (salen)
+		*salen = entry->salen;
+	if (socktype)
+		*socktype = entry->socktype;
+	if (protocol)
+		*protocol = entry->protocol;
+	if (ttl)
+		*ttl = entry->ttl;
+
+	return (const struct sockaddr *) &entry->sa;
 }
 
 /* netresolve_query_getaddrinfo:
@@ -100,13 +163,15 @@ netresolve_query_getaddrinfo(netresolve_t context,
 			NETRESOLVE_OPTION_SOCKTYPE, hints->ai_socktype,
 			NETRESOLVE_OPTION_PROTOCOL, hints->ai_protocol,
 			NETRESOLVE_OPTION_DEFAULT_LOOPBACK, !(hints->ai_flags & AI_PASSIVE),
+			NETRESOLVE_OPTION_ADDRCONFIG, !!(hints->ai_flags & AI_ADDRCONFIG),
 			NULL);
 }
 
 int
 netresolve_query_getaddrinfo_done(netresolve_query_t query, struct addrinfo **res, int32_t *ttlp)
 {
-	size_t npaths = netresolve_query_get_count(query);
+	size_t npaths;
+	const struct netresolve_sockaddr *sockaddrs = netresolve_query_get_sockaddrs(query, &npaths);
 	const char *canonname = netresolve_query_get_node_name(query);
 	struct addrinfo head = {0};
 	struct addrinfo *ai = &head;
@@ -116,29 +181,28 @@ netresolve_query_getaddrinfo_done(netresolve_query_t query, struct addrinfo **re
 		*ttlp = INT32_MAX;
 
 	for (i = 0; i < npaths; i++) {
-		int socktype, protocol;
-		socklen_t salen;
-		int32_t ttl;
+		const struct netresolve_sockaddr *entry = &sockaddrs[i];
 
-		const struct sockaddr *sa = netresolve_query_get_sockaddr(query, i, &salen, &socktype, &protocol, &ttl);
+		if (!entry->salen)
+			continue;
 
-		if (ttlp && ttl < *ttlp)
-			*ttlp = ttl;
+		if (ttlp && entry->ttl < *ttlp)
+			*ttlp = entry->ttl;
 
-		ai = ai->ai_next = calloc(1, sizeof *ai + salen);
+		ai = ai->ai_next = calloc(1, sizeof *ai + entry->salen);
 		if (!ai) {
 			freeaddrinfo(head.ai_next);
 			netresolve_query_free(query);
 			return EAI_SYSTEM;
 		}
-		ai->ai_family = sa->sa_family;
-		ai->ai_socktype = socktype;
-		ai->ai_protocol = protocol;
-		ai->ai_addrlen = salen;
+		ai->ai_family = entry->sa.ss_family;
+		ai->ai_socktype = entry->socktype;
+		ai->ai_protocol = entry->protocol;
+		ai->ai_addrlen = entry->salen;
 		ai->ai_addr = (struct sockaddr *) (ai + 1);
-		memcpy(ai->ai_addr, sa, salen);
+		memcpy(ai->ai_addr, &entry->sa, entry->salen);
 
-		if (i == 0 && canonname)
+		if (ai == head.ai_next && canonname)
 			ai->ai_canonname = strdup(canonname);
 	}
 
@@ -24,7 +24,6 @@
 #include <netresolve-private.h>
 #include <unistd.h>
 #include <string.h>
-#include <dlfcn.h>
 
 static bool
 getenv_bool(const char *name, bool def)
@@ -57,19 +56,29 @@ netresolve_context_new(void)
 
 	/* FIXME: this should probably be only called once */
 	netresolve_set_log_level(getenv_bool("NETRESOLVE_VERBOSE", false) ? NETRESOLVE_LOG_LEVEL_DEBUG : NETRESOLVE_LOG_LEVEL_QUIET);
+	if (getenv_bool("NETRESOLVE_TRACE", false))
+		netresolve_set_trace(true);
 
 	if (!(context = calloc(1, sizeof *context)))
 		return NULL;
 
 	context->queries.previous = context->queries.next = &context->queries;
 	context->epoll.fd = -1;
+	pthread_mutex_init(&context->lock, NULL);
 
 	context->config.force_family = getenv_family("NETRESOLVE_FORCE_FAMILY", AF_UNSPEC);
+	context->config.offload = getenv_bool("NETRESOLVE_OFFLOAD", true);
+	context->config.speculative = getenv_bool("NETRESOLVE_SPECULATIVE", false);
 
 	context->request.default_loopback = getenv_bool("NETRESOLVE_FLAG_DEFAULT_LOOPBACK", false);
+	context->request.addrconfig = getenv_bool("NETRESOLVE_FLAG_ADDRCONFIG", false);
 	context->request.clamp_ttl = getenv_int("NETRESOLVE_CLAMP_TTL", -1);
 	context->request.timeout = getenv_int("NETRESOLVE_TIMEOUT", 15000);
 	context->request.partial_timeout = getenv_int("NETRESOLVE_PARTIAL_TIMEOUT", 5000);
+	context->request.connect_delay = getenv_int("NETRESOLVE_CONNECT_DELAY", 250);
+	context->request.adaptive_timeouts = getenv_bool("NETRESOLVE_ADAPTIVE_TIMEOUTS", false);
+	context->request.timeout_floor = getenv_int("NETRESOLVE_TIMEOUT_FLOOR", 1000);
+	context->request.partial_timeout_floor = getenv_int("NETRESOLVE_PARTIAL_TIMEOUT_FLOOR", 20);
 
 	return context;
 }
@@ -83,127 +92,62 @@ netresolve_context_free(netresolve_t context)
 		netresolve_query_free(queries->next);
 
 	netresolve_set_backend_string(context, "");
+	netresolve_slab_clear(context);
+	netresolve_sort_clear(context);
+	free(context->rtt);
+	free(context->latency);
 	if (context->epoll.fd != -1 && close(context->epoll.fd) == -1)
 		abort();
 	if (context->callbacks.free_user_data)
 		context->callbacks.free_user_data(context->callbacks.user_data);
+	pthread_mutex_destroy(&context->lock);
 	memset(context, 0, sizeof *context);
 	free(context);
 }
 
+/* netresolve_context_lock:
+ *
+ * Serialize access to data shared by all queries of a context. This is
+ * a no-op unless the context is dispatched by multiple threads.
+ */
 void
-netresolve_context_set_options(netresolve_t context, ...)
+netresolve_context_lock(netresolve_t context)
 {
-	va_list ap;
-
-	va_start(ap, context);
-	netresolve_request_set_options_from_va(&context->request, ap);
-	va_end(ap);
+	if (context->threaded)
+		pthread_mutex_lock(&context->lock);
 }
 
-static void
-free_backend(struct netresolve_backend *backend)
+void
+netresolve_context_unlock(netresolve_t context)
 {
-	char **p;
-
-	if (!backend)
-		return;
-	if (backend->settings) {
-		for (p = backend->settings; *p; p++)
-			free(*p);
-		free(backend->settings);
-	}
-	if (backend->dl_handle)
-		dlclose(backend->dl_handle);
-	free(backend);
+	if (context->threaded)
+		pthread_mutex_unlock(&context->lock);
 }
 
-static struct netresolve_backend *
-load_backend(char **take_settings)
+void
+netresolve_context_set_options(netresolve_t context, ...)
 {
-	struct netresolve_backend *backend = calloc(1, sizeof *backend);
-	const char *name;
-	char filename[1024];
-
-	if (!backend)
-		return NULL;
-	if (!take_settings || !*take_settings)
-		goto fail;
-
-	name = *take_settings;
-	if (*name == '+') {
-		backend->mandatory = true;
-		name++;
-	}
-
-	backend->settings = take_settings;
-	snprintf(filename, sizeof filename, "libnetresolve-backend-%s.so", name);
-	backend->dl_handle = dlopen(filename, RTLD_NOW);
-	if (!backend->dl_handle) {
-		error("%s", dlerror());
-		goto fail;
-	}
-
-	backend->setup[NETRESOLVE_REQUEST_FORWARD] = dlsym(backend->dl_handle, "setup_forward");
-	backend->setup[NETRESOLVE_REQUEST_REVERSE] = dlsym(backend->dl_handle, "setup_reverse");
-	backend->setup[NETRESOLVE_REQUEST_DNS] = dlsym(backend->dl_handle, "setup_dns");
-	backend->dispatch = dlsym(backend->dl_handle, "dispatch");
-	backend->cleanup = dlsym(backend->dl_handle, "cleanup");
-
-	if (!backend->setup)
-		goto fail;
+	va_list ap;
 
-	return backend;
-fail:
-	free_backend(backend);
-	return NULL;
+	va_start(ap, context);
+	netresolve_request_set_options_from_va(&context->request, ap);
+	va_end(ap);
 }
 
 void
 netresolve_set_backend_string(netresolve_t context, const char *string)
 {
-	const char *setup, *end;
-	char **settings = NULL;
-	int nsettings = 0;
-	int nbackends = 0;
-
 	/* Default */
 	if (string == NULL)
 		string = "unix,any,loopback,numerichost,hosts,hostname,ubdns";
 
-	/* Clear old backends */
-	if (context->backends) {
-		struct netresolve_backend **backend;
-
-		for (backend = context->backends; *backend; backend++)
-			free_backend(*backend);
-		free(context->backends);
-		context->backends = NULL;
+	/* Release old backends */
+	if (context->chain) {
+		netresolve_chain_unref(context->chain);
+		context->chain = NULL;
 	}
 
 	/* Install new set of backends */
-	for (setup = end = string; true; end++) {
-		if (*end == ':' || *end == ',' || *end == '\0') {
-			settings = realloc(settings, (nsettings + 2) * sizeof *settings);
-			settings[nsettings++] = strndup(setup, end - setup);
-			settings[nsettings] = NULL;
-			setup = end + 1;
-		}
-		if (*end == ',' || *end == '\0') {
-			if (settings && *settings && **settings) {
-				context->backends = realloc(context->backends, (nbackends + 2) * sizeof *context->backends);
-				context->backends[nbackends] = load_backend(settings);
-				if (context->backends[nbackends]) {
-					nbackends++;
-					context->backends[nbackends] = NULL;
-				}
-			} else
-				free(settings);
-			nsettings = 0;
-			settings = NULL;
-		}
-		if (*end == '\0') {
-			break;
-		}
-	}
+	if (*string)
+		context->chain = netresolve_chain_get(string);
 }
@@ -58,6 +58,78 @@ unwatch_fd(netresolve_t context, int fd, void *handle)
 	loop->count--;
 }
 
+/* Multi-threaded mode uses edge-triggered oneshot events so that each event
+ * is delivered to exactly one thread and the source is not reported again
+ * until the dispatching thread re-arms it. Event data carry the file
+ * descriptor and a generation number instead of the source pointer, as the
+ * source may be removed by another thread before the event is processed.
+ */
+#define THREADED_EVENTS (EPOLLET | EPOLLONESHOT)
+
+static uint64_t
+threaded_data(int fd, uint32_t generation)
+{
+	return ((uint64_t) generation << 32) | (uint32_t) fd;
+}
+
+static void *
+watch_fd_threaded(netresolve_t context, int fd, int events, netresolve_source_t source)
+{
+	struct netresolve_epoll *loop = netresolve_get_user_data(context);
+	struct epoll_event event = { .events = events | THREADED_EVENTS };
+
+	netresolve_context_lock(context);
+
+	if (fd >= loop->nslots) {
+		int nslots = fd + 64;
+		struct netresolve_epoll_slot *slots = realloc(loop->slots, nslots * sizeof *slots);
+
+		if (!slots)
+			abort();
+		memset(slots + loop->nslots, 0, (nslots - loop->nslots) * sizeof *slots);
+		loop->slots = slots;
+		loop->nslots = nslots;
+	}
+
+	assert(!loop->slots[fd].source);
+	loop->slots[fd].source = source;
+	loop->slots[fd].generation = ++loop->generation;
+	event.data.u64 = threaded_data(fd, loop->generation);
+
+	if (epoll_ctl(loop->fd, EPOLL_CTL_ADD, fd, &event) == -1) {
+		error("epoll_ctl: %s", strerror(errno));
+		abort();
+	}
+
+	loop->count++;
+
+	netresolve_context_unlock(context);
+
+	return NULL;
+}
+
+static void
+unwatch_fd_threaded(netresolve_t context, int fd, void *handle)
+{
+	struct netresolve_epoll *loop = netresolve_get_user_data(context);
+
+	assert(handle == NULL);
+
+	netresolve_context_lock(context);
+
+	assert(fd < loop->nslots && loop->slots[fd].source);
+	loop->slots[fd].source = NULL;
+
+	if (epoll_ctl(loop->fd, EPOLL_CTL_DEL, fd, NULL) == -1) {
+		error("epoll_ctl: %s", strerror(errno));
+		abort();
+	}
+
+	loop->count--;
+
+	netresolve_context_unlock(context);
+}
+
 static void
 free_user_data(void *user_data)
 {
@@ -65,6 +137,8 @@ free_user_data(void *user_data)
 
 	assert(!loop->count);
 
+	free(loop->slots);
+
 	if (close(loop->fd) == -1)
 		abort();
 	free(loop);
@@ -115,6 +189,43 @@ netresolve_epoll_new(void)
 	return context;
 }
 
+/* netresolve_epoll_new_threaded:
+ *
+ * Same as `netresolve_epoll_new()` but the resulting context can be
+ * dispatched by several threads at once, each of them calling
+ * `netresolve_epoll_dispatch()` when the epoll file descriptor becomes
+ * readable. Every event is handed over to exactly one thread and different
+ * queries are processed in parallel, while callbacks of a single query are
+ * always serialized.
+ */
+netresolve_t
+netresolve_epoll_new_threaded(void)
+{
+	netresolve_t context = netresolve_context_new();
+	struct netresolve_epoll *loop;
+
+	if (!context)
+		return NULL;
+
+	if (!(loop = calloc(1, sizeof *loop)))
+		goto fail;
+	if ((loop->fd = epoll_create1(EPOLL_CLOEXEC)) == -1) {
+		error("epoll_create1: %s", strerror(errno));
+		free(loop);
+		goto fail;
+	}
+
+	context->threaded = true;
+	netresolve_set_fd_callbacks(context, watch_fd_threaded, unwatch_fd_threaded, loop, free_user_data);
+
+	debug("created threaded epoll file descriptor: %d", loop->fd);
+
+	return context;
+fail:
+	netresolve_context_free(context);
+	return NULL;
+}
+
 /* netresolve_epoll_fd:
  *
  * Retrieve the epoll file descriptor from the context. Do not add any file
@@ -145,6 +256,58 @@ netresolve_epoll_fd(netresolve_t context)
 	return loop->fd;
 }
 
+static void
+dispatch_threaded(netresolve_t context, uint64_t data, int events)
+{
+	struct netresolve_epoll *loop = netresolve_get_user_data(context);
+	int fd = (uint32_t) data;
+	uint32_t generation = data >> 32;
+	netresolve_source_t source;
+	netresolve_query_t query;
+
+	/* Take a reference so that the query survives until we're finished. */
+	netresolve_context_lock(context);
+	source = fd < loop->nslots && loop->slots[fd].generation == generation ? loop->slots[fd].source : NULL;
+	query = source ? source->query : NULL;
+	if (query)
+		query->refcount++;
+	netresolve_context_unlock(context);
+
+	if (!query) {
+		debug("dropping stale event: fd=%d", fd);
+		return;
+	}
+
+	netresolve_query_lock(query);
+
+	/* The source may have been removed while we were waiting for the lock. */
+	netresolve_context_lock(context);
+	if (query->freed || loop->slots[fd].source != source || loop->slots[fd].generation != generation)
+		source = NULL;
+	netresolve_context_unlock(context);
+
+	if (source) {
+		/* Errors and hangups are reported as the requested events. */
+		if (!netresolve_dispatch(context, source, events & source->events ?: source->events))
+			abort();
+
+		/* Re-arm the source unless it has been removed during dispatch. */
+		netresolve_context_lock(context);
+		if (loop->slots[fd].source == source && loop->slots[fd].generation == generation) {
+			struct epoll_event event = { .events = source->events | THREADED_EVENTS, .data = { .u64 = data } };
+
+			if (epoll_ctl(loop->fd, EPOLL_CTL_MOD, fd, &event) == -1) {
+				error("epoll_ctl: %s", strerror(errno));
+				abort();
+			}
+		}
+		netresolve_context_unlock(context);
+	}
+
+	netresolve_query_unlock(query);
+	netresolve_query_release(query);
+}
+
 static int
 dispatch_events(netresolve_t context, int timeout)
 {
@@ -169,7 +332,9 @@ dispatch_events(netresolve_t context, int timeout)
 		break;
 	default:
 		for (i = 0; i < nevents; i++)
-			if (!netresolve_dispatch(context, events[i].data.ptr, events[i].events))
+			if (context->threaded)
+				dispatch_threaded(context, events[i].data.u64, events[i].events);
+			else if (!netresolve_dispatch(context, events[i].data.ptr, events[i].events))
 				abort();
 	}
 
@@ -192,6 +357,19 @@ netresolve_epoll_dispatch(netresolve_t context)
 		;
 }
 
+static int
+get_count(netresolve_t context)
+{
+	struct netresolve_epoll *loop = netresolve_get_user_data(context);
+	int count;
+
+	netresolve_context_lock(context);
+	count = loop->count;
+	netresolve_context_unlock(context);
+
+	return count;
+}
+
 /* netresolve_epoll_wait:
  *
  * This function is used internally by netresolve to run an epoll based
@@ -203,8 +381,7 @@ netresolve_epoll_dispatch(netresolve_t context)
 void
 netresolve_epoll_wait(netresolve_t context)
 {
-	struct netresolve_epoll *loop = netresolve_get_user_data(context);
-
-	while (loop->count > 0)
-		dispatch_events(context, -1);
+	/* Other threads may finish the last query while we are waiting. */
+	while (get_count(context) > 0)
+		dispatch_events(context, context->threaded ? 100 : -1);
 }
@@ -54,6 +54,7 @@ netresolve_watch_fd(netresolve_query_t query, int fd, int events)
 {
 	struct netresolve_source *sources = &query->sources;
 	struct netresolve_source *source;
+	int nfds;
 
 	assert(fd >= 0);
 	assert(events && !(events & ~(POLLIN | POLLOUT)));
@@ -61,8 +62,11 @@ netresolve_watch_fd(netresolve_query_t query, int fd, int events)
 	if (!(source = calloc(1, sizeof(*source))))
 		abort();
 
+	netresolve_trace(query, NETRESOLVE_TRACE_WATCH, fd);
+
 	source->query = query;
 	source->fd = fd;
+	source->events = events;
 	source->handle = query->context->callbacks.watch_fd(query->context, fd, events, source);
 
 	source->previous = sources->previous;
@@ -70,9 +74,11 @@ netresolve_watch_fd(netresolve_query_t query, int fd, int events)
 	source->previous->next = source->next->previous = source;
 
 	query->nfds++;
-	query->context->nfds++;
+	netresolve_context_lock(query->context);
+	nfds = ++query->context->nfds;
+	netresolve_context_unlock(query->context);
 
-	debug_query(query, "added file descriptor: fd=%d events=%d source=%p (total %d/%d)", fd, events, source, query->nfds, query->context->nfds);
+	debug_query(query, "added file descriptor: fd=%d events=%d source=%p (total %d/%d)", fd, events, source, query->nfds, nfds);
 }
 
 void
@@ -80,6 +86,7 @@ netresolve_unwatch_fd(netresolve_query_t query, int fd)
 {
 	struct netresolve_source *sources = &query->sources;
 	struct netresolve_source *source;
+	int nfds;
 
 	assert(fd >= 0);
 
@@ -88,18 +95,22 @@ netresolve_unwatch_fd(netresolve_query_t query, int fd)
 			break;
 
 	assert(query->nfds > 0);
-	assert(query->context->nfds > 0);
 	assert(source != sources);
 
+	netresolve_trace(query, NETRESOLVE_TRACE_UNWATCH, fd);
+
 	source->previous->next = source->next;
 	source->next->previous = source->previous;
 
 	query->nfds--;
-	query->context->nfds--;
+	netresolve_context_lock(query->context);
+	assert(query->context->nfds > 0);
+	nfds = --query->context->nfds;
+	netresolve_context_unlock(query->context);
 
 	query->context->callbacks.unwatch_fd(query->context, fd, source->handle);
 
-	debug_query(query, "removed file descriptor: fd=%d source=%p (total %d/%d)", fd, source, query->nfds, query->context->nfds);
+	debug_query(query, "removed file descriptor: fd=%d source=%p (total %d/%d)", fd, source, query->nfds, nfds);
 
 	memset(source, 0, sizeof *source);
 	free(source);
@@ -144,15 +155,35 @@ netresolve_remove_timeout(netresolve_query_t query, int fd)
 bool
 netresolve_dispatch(netresolve_t context, netresolve_source_t source, int events)
 {
+	netresolve_query_t query;
+	bool handled;
+
 	assert(source);
 	assert(source->query);
 
+	/* Errors and hangups are reported as readiness so that the query picks
+	 * up the condition itself, e.g. a refused connection using `SO_ERROR`.
+	 */
+	if (events & (POLLERR | POLLHUP))
+		events = (events | source->events) & (POLLIN | POLLOUT);
+
 	if (!(events & (POLLIN | POLLOUT)) || (events & ~(POLLIN | POLLOUT))) {
 		error("Bad poll events %d for source %p.", events, source);
 		return false;
 	}
 
-	debug_query(source->query, "dispatching: fd=%d events=%d source=%p", source->fd, events, source);
+	query = source->query;
+
+	debug_query(query, "dispatching: fd=%d events=%d source=%p", source->fd, events, source);
+
+	/* Keep the query around even if it's freed during dispatch. */
+	netresolve_context_lock(context);
+	query->refcount++;
+	netresolve_context_unlock(context);
+
+	handled = netresolve_query_dispatch(query, source->fd, events);
+
+	netresolve_query_release(query);
 
-	return netresolve_query_dispatch(source->query, source->fd, events);
+	return handled;
 }
@@ -0,0 +1,198 @@
+/* Copyright (c) 2013 Pavel Šimerda, Red Hat, Inc. (psimerda at redhat.com) and others
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <netresolve-private.h>
+#include <string.h>
+#include <time.h>
+
+/* Backend latency
+ *
+ * A context keeps latency histograms for each backend it has used. One
+ * records how long the backend takes to finish, the other how long it
+ * takes from the first path to the last one, e.g. from the AAAA answer to
+ * the A answer. Queries cut short by a timeout are recorded at the time
+ * they were cut, so that a timeout that is too short shows up in the
+ * histogram and grows back.
+ *
+ * In adaptive mode, the partial timeout is taken from the 99th percentile
+ * of the gaps and the total timeout from the 99.9th percentile of the
+ * resolution times, within the configured floors and the static timeouts
+ * as ceilings. Until a backend has enough samples, the static timeouts
+ * apply.
+ *
+ * Buckets grow exponentially, bucket `i` holds samples shorter than `2^i`
+ * milliseconds. All buckets are halved once in a while so that the
+ * histograms follow changing conditions.
+ */
+#define LATENCY_BACKENDS 16
+#define LATENCY_BUCKETS 24
+#define LATENCY_MIN_SAMPLES 100
+#define LATENCY_MAX_SAMPLES 4096
+
+struct histogram {
+	uint32_t buckets[LATENCY_BUCKETS];
+	uint32_t count;
+};
+
+struct netresolve_latency {
+	struct latency_entry {
+		char name[32];
+		struct histogram histograms[_NETRESOLVE_LATENCY_TYPES];
+	} entries[LATENCY_BACKENDS];
+};
+
+static long
+elapsed_ms(const struct timespec *since)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec - since->tv_sec) * 1000L + (now.tv_nsec - since->tv_nsec) / 1000000;
+}
+
+static struct latency_entry *
+get_entry(netresolve_t context, const char *name, bool create)
+{
+	struct latency_entry *entry;
+	int i;
+
+	if (!context->latency && (!create || !(context->latency = calloc(1, sizeof *context->latency))))
+		return NULL;
+
+	for (i = 0; i < LATENCY_BACKENDS; i++) {
+		entry = &context->latency->entries[i];
+
+		if (!strncmp(entry->name, name, sizeof entry->name))
+			return entry;
+		if (!*entry->name) {
+			if (!create)
+				return NULL;
+			strncpy(entry->name, name, sizeof entry->name - 1);
+			return entry;
+		}
+	}
+
+	return NULL;
+}
+
+static const char *
+get_backend_name(netresolve_query_t query)
+{
+	struct netresolve_backend *backend = query->backend ? *query->backend : NULL;
+
+	return backend ? backend->name : NULL;
+}
+
+static void
+add_sample(struct histogram *histogram, long ms)
+{
+	int bucket = 0;
+	int i;
+
+	while (bucket < LATENCY_BUCKETS - 1 && ms >= (1L << bucket))
+		bucket++;
+
+	if (histogram->count == LATENCY_MAX_SAMPLES) {
+		histogram->count = 0;
+		for (i = 0; i < LATENCY_BUCKETS; i++)
+			histogram->count += histogram->buckets[i] /= 2;
+	}
+
+	histogram->buckets[bucket]++;
+	histogram->count++;
+}
+
+static long
+get_percentile(const struct histogram *histogram, int permille)
+{
+	uint64_t sum = 0;
+	int i;
+
+	for (i = 0; i < LATENCY_BUCKETS; i++) {
+		sum += histogram->buckets[i];
+		if (sum * 1000 >= (uint64_t) histogram->count * permille)
+			break;
+	}
+
+	return 1L << i;
+}
+
+/* netresolve_latency_record:
+ *
+ * Record the time since `since` for the current backend of the query. Does
+ * nothing unless adaptive timeouts are enabled.
+ */
+void
+netresolve_latency_record(netresolve_query_t query, enum netresolve_latency_type type, const struct timespec *since)
+{
+	netresolve_t context = query->context;
+	const char *name = get_backend_name(query);
+	struct latency_entry *entry;
+
+	if (!query->request.adaptive_timeouts || !name || !since->tv_sec)
+		return;
+
+	netresolve_context_lock(context);
+	if ((entry = get_entry(context, name, true)))
+		add_sample(&entry->histograms[type], elapsed_ms(since));
+	netresolve_context_unlock(context);
+}
+
+/* netresolve_latency_get_timeout:
+ *
+ * Returns the timeout in milliseconds for the current backend of the query.
+ * That's the static timeout unless adaptive timeouts are enabled and there
+ * is enough history.
+ */
+int
+netresolve_latency_get_timeout(netresolve_query_t query, enum netresolve_latency_type type)
+{
+	static const int permille[_NETRESOLVE_LATENCY_TYPES] = {
+		[NETRESOLVE_LATENCY_TOTAL] = 999,
+		[NETRESOLVE_LATENCY_PARTIAL] = 990,
+	};
+	netresolve_t context = query->context;
+	struct netresolve_request *request = &query->request;
+	int ceiling = type == NETRESOLVE_LATENCY_TOTAL ? request->timeout : request->partial_timeout;
+	int floor = type == NETRESOLVE_LATENCY_TOTAL ? request->timeout_floor : request->partial_timeout_floor;
+	const char *name = get_backend_name(query);
+	struct latency_entry *entry;
+	long timeout = ceiling;
+
+	if (!request->adaptive_timeouts || ceiling <= 0 || !name)
+		return ceiling;
+
+	netresolve_context_lock(context);
+	entry = get_entry(context, name, false);
+	if (entry && entry->histograms[type].count >= LATENCY_MIN_SAMPLES)
+		timeout = get_percentile(&entry->histograms[type], permille[type]);
+	netresolve_context_unlock(context);
+
+	if (timeout < floor)
+		timeout = floor;
+	if (timeout > ceiling)
+		timeout = ceiling;
+
+	return timeout;
+}
@@ -23,18 +23,19 @@
  */
 #include <netresolve-private.h>
 
-static enum netresolve_log_level log_level = 0;
+/* Read directly by the logging macros, see `netresolve_log_enabled()`. */
+int netresolve_log_threshold = 0;
 
 enum netresolve_log_level
 netresolve_get_log_level(void)
 {
-	return log_level;
+	return netresolve_log_threshold;
 }
 
 void
 netresolve_set_log_level(enum netresolve_log_level new_log_level)
 {
-	log_level = new_log_level;
+	netresolve_log_threshold = new_log_level;
 }
 
 void
@@ -0,0 +1,282 @@
+/* Copyright (c) 2013 Pavel Šimerda, Red Hat, Inc. (psimerda at redhat.com) and others
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <netresolve-private.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+
+/* Backends declared as blocking do all their work in the setup functions.
+ * In nonblocking mode, the setup is run in a worker thread on a scratch
+ * query with a private copy of the request and a reference to the chain
+ * of backends, so that the original query can go away at any time. The
+ * results are then merged into the original query when the worker
+ * signals the eventfd watched by the query.
+ */
+#define MAX_THREADS 8
+
+struct netresolve_offload {
+	struct netresolve_offload *next;
+	struct netresolve_query scratch;
+	void (*setup)(netresolve_query_t query, char **settings);
+	int fd;
+	bool finished;
+	bool cancelled;
+};
+
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct netresolve_offload *first, *last;
+	int nthreads;
+	int idle;
+} workers = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER };
+
+static void
+free_offload(struct netresolve_offload *offload)
+{
+	struct netresolve_query *scratch = &offload->scratch;
+
+	netresolve_chain_unref(scratch->chain);
+	free(scratch->request.nodename);
+	free(scratch->request.servname);
+	free(scratch->request.dns_name);
+	free(scratch->response.paths);
+	netresolve_backend_free_unix_paths(&scratch->response);
+	free(scratch->response.nodename);
+	free(scratch->response.servname);
+	free(scratch->response.dns.answer);
+	netresolve_service_list_free(scratch->services);
+	free(scratch->extra);
+	free(offload);
+}
+
+static void
+run_setup(struct netresolve_offload *offload)
+{
+	struct netresolve_query *scratch = &offload->scratch;
+	struct netresolve_backend *backend = *scratch->backend;
+
+	offload->setup(scratch, backend->settings + 1);
+
+	if (scratch->priv) {
+		if (backend->cleanup)
+			backend->cleanup(scratch);
+		netresolve_slab_free_priv(NULL, scratch->priv);
+		scratch->priv = NULL;
+	}
+}
+
+static void *
+run_worker(void *data)
+{
+	struct netresolve_offload *offload;
+	uint64_t value = 1;
+
+	pthread_mutex_lock(&workers.lock);
+	while (true) {
+		while (!workers.first) {
+			workers.idle++;
+			pthread_cond_wait(&workers.cond, &workers.lock);
+			workers.idle--;
+		}
+
+		offload = workers.first;
+		if (!(workers.first = offload->next))
+			workers.last = NULL;
+
+		if (offload->cancelled) {
+			free_offload(offload);
+			continue;
+		}
+
+		pthread_mutex_unlock(&workers.lock);
+		run_setup(offload);
+		pthread_mutex_lock(&workers.lock);
+
+		/* The owner closes the eventfd after marking the setup as cancelled. */
+		offload->finished = true;
+		if (offload->cancelled)
+			free_offload(offload);
+		else if (write(offload->fd, &value, sizeof value) == -1)
+			abort();
+	}
+
+	return NULL;
+}
+
+static bool
+submit(struct netresolve_offload *offload)
+{
+	pthread_t thread;
+	bool success = true;
+
+	pthread_mutex_lock(&workers.lock);
+
+	if (!workers.idle && workers.nthreads < MAX_THREADS) {
+		if (!pthread_create(&thread, NULL, run_worker, NULL)) {
+			pthread_detach(thread);
+			workers.nthreads++;
+		} else if (!workers.nthreads)
+			success = false;
+	}
+
+	if (success) {
+		offload->next = NULL;
+		if (workers.last)
+			workers.last->next = offload;
+		else
+			workers.first = offload;
+		workers.last = offload;
+		pthread_cond_signal(&workers.cond);
+	}
+
+	pthread_mutex_unlock(&workers.lock);
+
+	return success;
+}
+
+/* netresolve_offload_setup:
+ *
+ * Start the setup of a blocking backend in a worker thread. Returns `false`
+ * when the setup is to be run directly, e.g. for nonblocking backends or
+ * in blocking mode where there is nothing to gain.
+ */
+bool
+netresolve_offload_setup(netresolve_query_t query)
+{
+	netresolve_t context = query->context;
+	struct netresolve_backend *backend = *query->backend;
+	struct netresolve_offload *offload;
+	struct netresolve_query *scratch;
+	struct netresolve_request *request;
+
+	if (!backend->blocking || !context->config.offload || query->offloaded)
+		return false;
+	if (context->callbacks.user_data == &context->epoll)
+		return false;
+
+	if (!(offload = calloc(1, sizeof *offload)))
+		return false;
+
+	offload->fd = -1;
+	offload->setup = backend->setup[query->request.type];
+
+	scratch = &offload->scratch;
+	request = &scratch->request;
+	scratch->offloaded = true;
+	scratch->state = NETRESOLVE_STATE_SETUP;
+	scratch->chain = netresolve_chain_ref(query->chain);
+	scratch->backend = query->backend;
+	scratch->sources.previous = scratch->sources.next = &scratch->sources;
+	memcpy(request, &query->request, sizeof *request);
+	request->nodename = request->nodename ? strdup(request->nodename) : NULL;
+	request->servname = request->servname ? strdup(request->servname) : NULL;
+	request->dns_name = request->dns_name ? strdup(request->dns_name) : NULL;
+
+	if ((offload->fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1)
+		goto fail;
+
+	netresolve_watch_fd(query, offload->fd, POLLIN);
+	query->offload = offload;
+
+	if (!submit(offload)) {
+		netresolve_unwatch_fd(query, offload->fd);
+		query->offload = NULL;
+		goto fail;
+	}
+
+	debug_query(query, "setup offloaded to a worker thread: fd=%d", offload->fd);
+
+	return true;
+fail:
+	if (offload->fd != -1)
+		close(offload->fd);
+	free_offload(offload);
+	return false;
+}
+
+/* netresolve_offload_dispatch:
+ *
+ * Pick up the result of an offloaded setup. Returns `false` if the event
+ * doesn't belong to the offloaded setup.
+ */
+bool
+netresolve_offload_dispatch(netresolve_query_t query, int fd)
+{
+	struct netresolve_offload *offload = query->offload;
+	enum netresolve_state state;
+
+	if (!offload || fd != offload->fd)
+		return false;
+
+	pthread_mutex_lock(&workers.lock);
+	assert(offload->finished);
+	pthread_mutex_unlock(&workers.lock);
+
+	query->offload = NULL;
+	netresolve_unwatch_fd(query, fd);
+	close(fd);
+
+	state = offload->scratch.state;
+	netresolve_backend_merge_response(query, &offload->scratch);
+	free_offload(offload);
+
+	debug_query(query, "offloaded setup finished: %s", netresolve_query_state_to_string(state));
+
+	if (state == NETRESOLVE_STATE_RESOLVED) {
+		netresolve_query_set_state(query, NETRESOLVE_STATE_RESOLVED);
+		netresolve_query_set_state(query, NETRESOLVE_STATE_DONE);
+	} else
+		netresolve_query_set_state(query, NETRESOLVE_STATE_FAILED);
+
+	return true;
+}
+
+/* netresolve_offload_cancel:
+ *
+ * Detach an offloaded setup from the query. A setup that is still queued
+ * or running is freed by the worker thread.
+ */
+void
+netresolve_offload_cancel(netresolve_query_t query)
+{
+	struct netresolve_offload *offload = query->offload;
+	bool finished;
+
+	query->offload = NULL;
+	netresolve_unwatch_fd(query, offload->fd);
+
+	pthread_mutex_lock(&workers.lock);
+	finished = offload->finished;
+	offload->cancelled = true;
+	pthread_mutex_unlock(&workers.lock);
+
+	/* The worker doesn't touch the eventfd once the setup is cancelled. */
+	close(offload->fd);
+
+	if (finished)
+		free_offload(offload);
+
+	debug_query(query, "offloaded setup cancelled");
+}
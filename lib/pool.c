@@ -0,0 +1,486 @@
+/* Copyright (c) 2013 Pavel Šimerda, Red Hat, Inc. (psimerda at redhat.com) and others
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <netresolve-pool.h>
+#include <netresolve-epoll.h>
+#include <netresolve-private.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+
+/* Queries submitted to the pool and, optionally, finished queries posted
+ * back to the application travel through intrusive multiple-producer
+ * single-consumer queues. Producers never block each other, the consumer
+ * is woken up using an eventfd.
+ */
+struct netresolve_pool_job {
+	_Atomic(struct netresolve_pool_job *) next;
+	struct netresolve_pool *pool;
+	struct netresolve_request request;
+	netresolve_query_callback callback;
+	void *user_data;
+	netresolve_query_t query;
+	bool finished;
+};
+
+struct netresolve_pool_queue {
+	_Atomic(struct netresolve_pool_job *) head;
+	struct netresolve_pool_job *tail;
+	struct netresolve_pool_job stub;
+	int fd;
+};
+
+struct netresolve_pool_worker {
+	struct netresolve_pool *pool;
+	pthread_t thread;
+	netresolve_t context;
+	struct netresolve_pool_queue queue;
+};
+
+struct netresolve_pool {
+	struct netresolve_pool_worker *workers;
+	int nworkers;
+	atomic_uint next_worker;
+	atomic_bool stopping;
+	/* Template for new requests */
+	struct netresolve_request request;
+	/* Completions posted back to the application, see `netresolve_pool_fd()` */
+	bool post_completions;
+	struct netresolve_pool_queue completions;
+};
+
+static bool
+queue_init(struct netresolve_pool_queue *queue)
+{
+	atomic_init(&queue->stub.next, NULL);
+	atomic_init(&queue->head, &queue->stub);
+	queue->tail = &queue->stub;
+
+	return (queue->fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) != -1;
+}
+
+static void
+queue_push(struct netresolve_pool_queue *queue, struct netresolve_pool_job *job)
+{
+	struct netresolve_pool_job *previous;
+
+	atomic_store_explicit(&job->next, NULL, memory_order_relaxed);
+	previous = atomic_exchange_explicit(&queue->head, job, memory_order_acq_rel);
+	atomic_store_explicit(&previous->next, job, memory_order_release);
+}
+
+/* Returns NULL when the queue is empty or when a producer is in the middle
+ * of a push. In the latter case, the producer's wakeup follows.
+ */
+static struct netresolve_pool_job *
+queue_pop(struct netresolve_pool_queue *queue)
+{
+	struct netresolve_pool_job *tail = queue->tail;
+	struct netresolve_pool_job *next = atomic_load_explicit(&tail->next, memory_order_acquire);
+
+	if (tail == &queue->stub) {
+		if (!next)
+			return NULL;
+		queue->tail = tail = next;
+		next = atomic_load_explicit(&tail->next, memory_order_acquire);
+	}
+	if (next) {
+		queue->tail = next;
+		return tail;
+	}
+	if (tail != atomic_load_explicit(&queue->head, memory_order_acquire))
+		return NULL;
+	queue_push(queue, &queue->stub);
+	next = atomic_load_explicit(&tail->next, memory_order_acquire);
+	if (next) {
+		queue->tail = next;
+		return tail;
+	}
+
+	return NULL;
+}
+
+static void
+queue_wakeup(struct netresolve_pool_queue *queue)
+{
+	uint64_t value = 1;
+
+	if (write(queue->fd, &value, sizeof value) == -1 && errno != EAGAIN)
+		abort();
+}
+
+static void
+queue_clear_wakeup(struct netresolve_pool_queue *queue)
+{
+	uint64_t value;
+
+	if (read(queue->fd, &value, sizeof value) == -1 && errno != EAGAIN)
+		abort();
+}
+
+static void
+free_job(struct netresolve_pool_job *job)
+{
+	if (job->query)
+		netresolve_query_free(job->query);
+	else {
+		free(job->request.nodename);
+		free(job->request.servname);
+		free(job->request.dns_name);
+	}
+	free(job);
+}
+
+static void
+job_callback(netresolve_query_t query, void *user_data)
+{
+	struct netresolve_pool_job *job = user_data;
+
+	/* The callback is also run when the query continues with a mandatory backend. */
+	if (job->finished || (query->state != NETRESOLVE_STATE_DONE && query->state != NETRESOLVE_STATE_FAILED))
+		return;
+	job->finished = true;
+
+	if (job->pool->post_completions) {
+		queue_push(&job->pool->completions, job);
+		queue_wakeup(&job->pool->completions);
+		return;
+	}
+
+	if (job->callback)
+		job->callback(query, job->user_data);
+	free_job(job);
+}
+
+static void
+start_job(struct netresolve_pool_worker *worker, struct netresolve_pool_job *job)
+{
+	netresolve_query_t query;
+
+	if (!(query = netresolve_query_new(worker->context, job->request.type)))
+		abort();
+
+	/* The query takes over the strings. */
+	memcpy(&query->request, &job->request, sizeof query->request);
+	query->callback = job_callback;
+	query->user_data = job;
+	job->query = query;
+
+	netresolve_query_setup(query);
+}
+
+static void *
+run_worker(void *data)
+{
+	struct netresolve_pool_worker *worker = data;
+	struct netresolve_pool_job *job;
+	struct pollfd fds[2] = {
+		{ .fd = worker->queue.fd, .events = POLLIN },
+		{ .fd = netresolve_epoll_fd(worker->context), .events = POLLIN },
+	};
+
+	while (!atomic_load(&worker->pool->stopping)) {
+		if (poll(fds, 2, -1) == -1) {
+			if (errno == EINTR)
+				continue;
+			error("poll: %s", strerror(errno));
+			abort();
+		}
+		if (fds[0].revents & POLLIN) {
+			queue_clear_wakeup(&worker->queue);
+			while ((job = queue_pop(&worker->queue)))
+				start_job(worker, job);
+		}
+		if (fds[1].revents & POLLIN)
+			netresolve_epoll_dispatch(worker->context);
+	}
+
+	return NULL;
+}
+
+static void
+free_worker(struct netresolve_pool_worker *worker)
+{
+	struct netresolve_query *queries;
+	struct netresolve_pool_job *job;
+	netresolve_query_t query;
+
+	if (!worker->context)
+		return;
+
+	while ((job = queue_pop(&worker->queue)))
+		free_job(job);
+	close(worker->queue.fd);
+
+	/* Unfinished queries are freed together with the context. */
+	queries = &worker->context->queries;
+	for (query = queries->next; query != queries; query = query->next)
+		if (query->callback == job_callback) {
+			((struct netresolve_pool_job *) query->user_data)->query = NULL;
+			free(query->user_data);
+		}
+	netresolve_context_free(worker->context);
+}
+
+/* netresolve_pool_new:
+ *
+ * Create a pool of `nthreads` worker threads, each of them owning a
+ * nonblocking netresolve context. Queries can be submitted to the pool from
+ * any thread and they are distributed among the workers. By default, query
+ * callbacks are run in the worker threads, see `netresolve_pool_fd()` for
+ * an alternative. The query is only valid during the callback and it is
+ * freed automatically afterwards. Use `netresolve_pool_free()` to stop the
+ * workers and dispose of the pool.
+ */
+netresolve_pool_t
+netresolve_pool_new(int nthreads)
+{
+	netresolve_pool_t pool;
+	int i;
+
+	if (nthreads <= 0)
+		nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (nthreads <= 0)
+		nthreads = 1;
+
+	if (!(pool = calloc(1, sizeof *pool)))
+		return NULL;
+	pool->completions.fd = -1;
+	if (!queue_init(&pool->completions))
+		goto fail;
+	if (!(pool->workers = calloc(nthreads, sizeof *pool->workers)))
+		goto fail;
+
+	/* Contexts are created here as their construction is not thread-safe. */
+	for (i = 0; i < nthreads; i++) {
+		struct netresolve_pool_worker *worker = &pool->workers[i];
+
+		worker->pool = pool;
+		if (!queue_init(&worker->queue))
+			goto fail;
+		if (!(worker->context = netresolve_epoll_new_threaded())) {
+			close(worker->queue.fd);
+			goto fail;
+		}
+		pool->nworkers++;
+	}
+
+	memcpy(&pool->request, &pool->workers[0].context->request, sizeof pool->request);
+
+	for (i = 0; i < pool->nworkers; i++) {
+		struct netresolve_pool_worker *worker = &pool->workers[i];
+
+		if (pthread_create(&worker->thread, NULL, run_worker, worker)) {
+			netresolve_pool_free(pool);
+			return NULL;
+		}
+	}
+
+	debug("created pool of %d workers", pool->nworkers);
+
+	return pool;
+fail:
+	netresolve_pool_free(pool);
+	return NULL;
+}
+
+/* netresolve_pool_free:
+ *
+ * Stop the worker threads and free the pool. Queries that haven't been
+ * finished yet are cancelled without running their callbacks.
+ */
+void
+netresolve_pool_free(netresolve_pool_t pool)
+{
+	struct netresolve_pool_job *job;
+	int i;
+
+	atomic_store(&pool->stopping, true);
+	for (i = 0; i < pool->nworkers; i++) {
+		struct netresolve_pool_worker *worker = &pool->workers[i];
+
+		if (worker->thread) {
+			queue_wakeup(&worker->queue);
+			pthread_join(worker->thread, NULL);
+		}
+	}
+
+	if (pool->completions.fd != -1) {
+		while ((job = queue_pop(&pool->completions)))
+			free_job(job);
+		close(pool->completions.fd);
+	}
+
+	for (i = 0; i < pool->nworkers; i++)
+		free_worker(&pool->workers[i]);
+	free(pool->workers);
+
+	free(pool->request.nodename);
+	free(pool->request.servname);
+	free(pool->request.dns_name);
+	free(pool);
+}
+
+/* netresolve_pool_set_options:
+ *
+ * Same as `netresolve_context_set_options()`, applies to queries submitted
+ * afterwards. Don't call it while other threads are submitting queries.
+ */
+void
+netresolve_pool_set_options(netresolve_pool_t pool, ...)
+{
+	va_list ap;
+
+	va_start(ap, pool);
+	netresolve_request_set_options_from_va(&pool->request, ap);
+	va_end(ap);
+}
+
+static bool
+submit(netresolve_pool_t pool, netresolve_query_callback callback, void *user_data,
+		enum netresolve_request_type type, ...)
+{
+	struct netresolve_pool_worker *worker;
+	struct netresolve_pool_job *job;
+	va_list ap;
+
+	if (!(job = calloc(1, sizeof *job)))
+		return false;
+
+	job->pool = pool;
+	job->callback = callback;
+	job->user_data = user_data;
+	memcpy(&job->request, &pool->request, sizeof job->request);
+	job->request.type = type;
+	job->request.nodename = NULL;
+	job->request.servname = NULL;
+	job->request.dns_name = NULL;
+
+	va_start(ap, type);
+	if (!netresolve_request_set_options_from_va(&job->request, ap)) {
+		free_job(job);
+		va_end(ap);
+		return false;
+	}
+	va_end(ap);
+
+	worker = &pool->workers[atomic_fetch_add_explicit(&pool->next_worker, 1, memory_order_relaxed) % pool->nworkers];
+	queue_push(&worker->queue, job);
+	queue_wakeup(&worker->queue);
+
+	return true;
+}
+
+/* netresolve_pool_query_forward:
+ *
+ * Submit a forward query to the pool. This function can be called from any
+ * thread. Returns `false` when the query couldn't be submitted.
+ */
+bool
+netresolve_pool_query_forward(netresolve_pool_t pool,
+		const char *nodename, const char *servname,
+		netresolve_query_callback callback, void *user_data)
+{
+	return submit(pool, callback, user_data,
+			NETRESOLVE_REQUEST_FORWARD,
+			NETRESOLVE_OPTION_NODE_NAME, nodename,
+			NETRESOLVE_OPTION_SERVICE_NAME, servname,
+			NULL);
+}
+
+bool
+netresolve_pool_query_reverse(netresolve_pool_t pool,
+		int family, const void *address, int ifindex, int protocol, int port,
+		netresolve_query_callback callback, void *user_data)
+{
+	enum netresolve_option address_option;
+
+	switch (family) {
+	case AF_INET:
+		address_option = NETRESOLVE_OPTION_IP4_ADDRESS;
+		break;
+	case AF_INET6:
+		address_option = NETRESOLVE_OPTION_IP6_ADDRESS;
+		break;
+	default:
+		return false;
+	}
+
+	return submit(pool, callback, user_data,
+			NETRESOLVE_REQUEST_REVERSE,
+			address_option, address,
+			NETRESOLVE_OPTION_IFINDEX, ifindex,
+			NETRESOLVE_OPTION_PROTOCOL, protocol,
+			NETRESOLVE_OPTION_PORT, port,
+			NULL);
+}
+
+bool
+netresolve_pool_query_dns(netresolve_pool_t pool,
+		const char *dname, int cls, int type,
+		netresolve_query_callback callback, void *user_data)
+{
+	return submit(pool, callback, user_data,
+			NETRESOLVE_REQUEST_DNS,
+			NETRESOLVE_OPTION_DNS_NAME, dname,
+			NETRESOLVE_OPTION_DNS_CLASS, cls,
+			NETRESOLVE_OPTION_DNS_TYPE, type,
+			NULL);
+}
+
+/* netresolve_pool_fd:
+ *
+ * Retrieve a file descriptor that becomes readable when there are finished
+ * queries to be picked up using `netresolve_pool_dispatch()`. Calling this
+ * function before submitting the first query makes the pool post finished
+ * queries back to the application instead of running the callbacks in the
+ * worker threads.
+ */
+int
+netresolve_pool_fd(netresolve_pool_t pool)
+{
+	pool->post_completions = true;
+
+	return pool->completions.fd;
+}
+
+/* netresolve_pool_dispatch:
+ *
+ * Call this function when the pool file descriptor is ready for reading.
+ * It runs the callbacks of finished queries in the calling thread. Only
+ * one thread may dispatch the pool at a time.
+ */
+void
+netresolve_pool_dispatch(netresolve_pool_t pool)
+{
+	struct netresolve_pool_job *job;
+
+	queue_clear_wakeup(&pool->completions);
+
+	while ((job = queue_pop(&pool->completions))) {
+		if (job->callback)
+			job->callback(job->query, job->user_data);
+		free_job(job);
+	}
+}
@@ -71,11 +71,16 @@ cleanup_query(netresolve_query_t query)
 	clear_timeout(query, &query->timeout_fd);
 	clear_timeout(query, &query->partial_timeout_fd);
 
-	if (backend && backend->data) {
+	if (query->offload)
+		netresolve_offload_cancel(query);
+	if (query->speculation.children)
+		netresolve_speculation_cancel(query);
+
+	if (backend && query->priv) {
 		if (backend->cleanup)
 			backend->cleanup(query);
-		free(backend->data);
-		backend->data = NULL;
+		netresolve_slab_free_priv(query->context, query->priv);
+		query->priv = NULL;
 	}
 }
 
@@ -91,12 +96,18 @@ netresolve_query_set_state(netresolve_query_t query, enum netresolve_state state
 			netresolve_query_state_to_string(old_state), netresolve_query_state_to_string(state));
 
 	query->state = state;
+	netresolve_trace(query, NETRESOLVE_TRACE_STATE, state);
+
+	/* Setup running in a worker thread only records the state. */
+	if (query->offloaded)
+		return;
 
 	/* Entering state... */
 	switch (state) {
 	case NETRESOLVE_STATE_NONE:
-		free(query->request.dns_name);
 		free(query->response.paths);
+		netresolve_backend_free_unix_paths(&query->response);
+		free(query->response.sockaddrs);
 		free(query->response.nodename);
 		free(query->response.servname);
 		netresolve_service_list_free(query->services);
@@ -107,12 +118,26 @@ netresolve_query_set_state(netresolve_query_t query, enum netresolve_state state
 			struct netresolve_backend *backend = *query->backend;
 			void (*setup)(netresolve_query_t query, char **settings);
 
+			/* Latency is only measured for adaptive timeouts. */
+			if (query->request.adaptive_timeouts)
+				clock_gettime(CLOCK_MONOTONIC, &query->started);
+			memset(&query->partial, 0, sizeof query->partial);
+
 			if (query->request.dns_srv_lookup && !query->request.protocol)
 				query->request.protocol = IPPROTO_TCP;
 
+			if (netresolve_speculation_start(query))
+				break;
+
+			if (!netresolve_module_load(backend)) {
+				netresolve_query_set_state(query, NETRESOLVE_STATE_FAILED);
+				break;
+			}
+
 			setup = backend->setup[query->request.type];
 			if (setup) {
-				setup(query, backend->settings + 1);
+				if (!netresolve_offload_setup(query))
+					setup(query, backend->settings + 1);
 				if (query->state == NETRESOLVE_STATE_SETUP)
 					netresolve_query_set_state(query, query->request.timeout ? NETRESOLVE_STATE_WAITING : NETRESOLVE_STATE_FAILED);
 				if (query->state == NETRESOLVE_STATE_ERROR)
@@ -122,16 +147,32 @@ netresolve_query_set_state(netresolve_query_t query, enum netresolve_state state
 		}
 		break;
 	case NETRESOLVE_STATE_WAITING:
-		if (query->request.timeout > 0)
-			query->timeout_fd = netresolve_add_timeout_ms(query, query->request.timeout);
+		{
+			int timeout = netresolve_latency_get_timeout(query, NETRESOLVE_LATENCY_TOTAL);
+
+			if (timeout > 0)
+				query->timeout_fd = netresolve_add_timeout_ms(query, timeout);
+		}
 		break;
 	case NETRESOLVE_STATE_WAITING_MORE:
-		if (query->request.partial_timeout == 0)
-			netresolve_query_set_state(query, NETRESOLVE_STATE_DONE);
-		if (query->request.partial_timeout > 0)
-			query->partial_timeout_fd = netresolve_add_timeout_ms(query, query->request.partial_timeout);
+		{
+			int timeout = netresolve_latency_get_timeout(query, NETRESOLVE_LATENCY_PARTIAL);
+
+			if (query->request.adaptive_timeouts)
+				clock_gettime(CLOCK_MONOTONIC, &query->partial);
+			if (timeout == 0)
+				netresolve_query_set_state(query, NETRESOLVE_STATE_DONE);
+			if (timeout > 0)
+				query->partial_timeout_fd = netresolve_add_timeout_ms(query, timeout);
+		}
+		if (query->state == NETRESOLVE_STATE_WAITING_MORE)
+			netresolve_query_update(query);
 		break;
 	case NETRESOLVE_STATE_RESOLVED:
+		if (old_state == NETRESOLVE_STATE_WAITING || old_state == NETRESOLVE_STATE_WAITING_MORE)
+			netresolve_latency_record(query, NETRESOLVE_LATENCY_TOTAL, &query->started);
+		if (old_state == NETRESOLVE_STATE_WAITING_MORE)
+			netresolve_latency_record(query, NETRESOLVE_LATENCY_PARTIAL, &query->partial);
 		if (old_state == NETRESOLVE_STATE_SETUP) {
 			if ((query->delayed_fd = eventfd(1, EFD_NONBLOCK)) == -1) {
 				error("can't create eventfd");
@@ -141,8 +182,23 @@ netresolve_query_set_state(netresolve_query_t query, enum netresolve_state state
 		}
 		break;
 	case NETRESOLVE_STATE_DONE:
+		/* Cut short by the partial timeout */
+		if (old_state == NETRESOLVE_STATE_WAITING_MORE) {
+			netresolve_latency_record(query, NETRESOLVE_LATENCY_TOTAL, &query->started);
+			netresolve_latency_record(query, NETRESOLVE_LATENCY_PARTIAL, &query->partial);
+		}
+
 		cleanup_query(query);
 
+		if (query->parent) {
+			netresolve_speculation_notify(query);
+			break;
+		}
+
+		netresolve_sort_paths(query);
+		/* Paths were reordered, only report those of the next backend. */
+		query->response.reported = query->response.pathcount;
+
 		/* Restart with the next *mandatory* backend. */
 		while (*++query->backend) {
 			if ((*query->backend)->mandatory) {
@@ -160,8 +216,17 @@ netresolve_query_set_state(netresolve_query_t query, enum netresolve_state state
 		if (query->response.pathcount)
 			error("Failed reply has data.");
 
+		/* Cut short by the timeout */
+		if (old_state == NETRESOLVE_STATE_WAITING || old_state == NETRESOLVE_STATE_WAITING_MORE)
+			netresolve_latency_record(query, NETRESOLVE_LATENCY_TOTAL, &query->started);
+
 		cleanup_query(query);
 
+		if (query->parent) {
+			netresolve_speculation_notify(query);
+			break;
+		}
+
 		/* Restart with the next backend. */
 		if (*++query->backend) {
 			netresolve_query_set_state(query, NETRESOLVE_STATE_SETUP);
@@ -174,32 +239,60 @@ netresolve_query_set_state(netresolve_query_t query, enum netresolve_state state
 	}
 }
 
-netresolve_query_t
-netresolve_query_new(netresolve_t context, enum netresolve_request_type type)
+/* netresolve_query_update:
+ *
+ * Called when paths arrive while the query is waiting for more, so that
+ * they can be used before the query is finished.
+ */
+void
+netresolve_query_update(netresolve_query_t query)
+{
+	netresolve_path_callback callback = query->request.path_callback;
+	struct netresolve_response *response = &query->response;
+
+	if (callback && !query->parent)
+		while (response->reported < response->pathcount)
+			callback(query, response->reported++, query->user_data);
+
+	netresolve_connect_update(query);
+}
+
+static netresolve_query_t
+query_new(netresolve_t context, const struct netresolve_request *request, enum netresolve_request_type type)
 {
 	struct netresolve_query *queries = &context->queries;
 	netresolve_query_t query;
+	pthread_mutexattr_t attr;
 
-	if (!(query = calloc(1, sizeof *query)))
+	if (!(query = netresolve_slab_alloc_query(context)))
 		return NULL;
 
+	netresolve_context_lock(context);
 	query->previous = queries->previous;
 	query->next = queries;
 	query->previous->next = query->next->previous = query;
+	netresolve_context_unlock(context);
 
 	query->context = context;
 	query->sources.previous = query->sources.next = &query->sources;
 
-	if (!context->backends)
+	/* Callbacks may free the query while it is being dispatched. */
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&query->lock, &attr);
+	pthread_mutexattr_destroy(&attr);
+
+	if (!context->chain)
 		netresolve_set_backend_string(context, secure_getenv("NETRESOLVE_BACKENDS"));
-	if (!context->backends || !*context->backends)
+	if (!context->chain || !*context->chain->backends)
 		abort();
 
 	query->delayed_fd = -1;
 	query->timeout_fd = -1;
 	query->partial_timeout_fd = -1;
-	query->backend = context->backends;
-	memcpy(&query->request, &context->request, sizeof context->request);
+	query->chain = netresolve_chain_ref(context->chain);
+	query->backend = query->chain->backends;
+	memcpy(&query->request, request, sizeof *request);
 
 	query->request.type = type;
 
@@ -208,6 +301,12 @@ netresolve_query_new(netresolve_t context, enum netresolve_request_type type)
 	return query;
 }
 
+netresolve_query_t
+netresolve_query_new(netresolve_t context, enum netresolve_request_type type)
+{
+	return query_new(context, &context->request, type);
+}
+
 netresolve_query_t
 netresolve_query( netresolve_t context, netresolve_query_callback callback, void *user_data,
 		enum netresolve_option type, ...)
@@ -239,20 +338,47 @@ netresolve_query( netresolve_t context, netresolve_query_callback callback, void
 	}
 	va_end(ap);
 
+	netresolve_query_setup(query);
+
+	return query;
+}
+
+/* netresolve_query_setup:
+ *
+ * Start a query that has been created using `netresolve_query_new()` and
+ * filled in with the request. In blocking mode, the function returns once
+ * the query is finished.
+ */
+void
+netresolve_query_setup(netresolve_query_t query)
+{
+	netresolve_t context = query->context;
+
 	if (context->config.force_family)
 		query->request.family = context->config.force_family;
+	else if (query->request.type == NETRESOLVE_REQUEST_FORWARD && query->request.family == AF_UNSPEC && query->request.addrconfig)
+		query->request.family = netresolve_sort_addrconfig(context);
 
 	/* Install default callbacks for first query in blocking mode. */
 	if (!context->callbacks.watch_fd)
 		netresolve_epoll_install(context, &context->epoll, NULL);
 
-	netresolve_query_set_state(query, NETRESOLVE_STATE_SETUP);
+	if (context->threaded) {
+		/* Other threads may receive events before the setup is finished. */
+		netresolve_context_lock(context);
+		query->refcount++;
+		netresolve_context_unlock(context);
+
+		netresolve_query_lock(query);
+		netresolve_query_set_state(query, NETRESOLVE_STATE_SETUP);
+		netresolve_query_unlock(query);
+		netresolve_query_release(query);
+	} else
+		netresolve_query_set_state(query, NETRESOLVE_STATE_SETUP);
 
 	/* Wait for the context in blocking mode. */
 	if (context->callbacks.user_data == &context->epoll)
 		netresolve_epoll_wait(context);
-
-	return query;
 }
 
 netresolve_query_t
@@ -267,6 +393,39 @@ netresolve_query_forward(netresolve_t context,
 			NULL);
 }
 
+/* netresolve_request_forward:
+ *
+ * Start a forward query using a request prepared by
+ * `netresolve_request_new()`. The node and service names override those of
+ * the request when not NULL. Only the names that differ are copied, the
+ * rest of the request is shared with the prepared one.
+ */
+netresolve_query_t
+netresolve_request_forward(netresolve_request_t request,
+		const char *nodename, const char *servname,
+		netresolve_query_callback callback, void *user_data)
+{
+	netresolve_query_t query;
+
+	if (!(query = query_new(request->context, &request->request, NETRESOLVE_REQUEST_FORWARD)))
+		return NULL;
+
+	query->callback = callback;
+	query->user_data = user_data;
+	query->template = netresolve_template_ref(request);
+	if (nodename && !(query->request.nodename = strdup(nodename)))
+		goto fail;
+	if (servname && !(query->request.servname = strdup(servname)))
+		goto fail;
+
+	netresolve_query_setup(query);
+
+	return query;
+fail:
+	netresolve_query_free(query);
+	return NULL;
+}
+
 netresolve_query_t
 netresolve_query_reverse(netresolve_t context,
 		int family, const void *address, int ifindex, int protocol, int port,
@@ -331,6 +490,8 @@ netresolve_query_dispatch(netresolve_query_t query, int fd, int events)
 {
 	struct netresolve_backend *backend = query->backend ? *query->backend : NULL;
 
+	netresolve_trace(query, NETRESOLVE_TRACE_DISPATCH, fd);
+
 	switch (query->state) {
 	case NETRESOLVE_STATE_WAITING_MORE:
 		if (dispatch_timeout(query, &query->partial_timeout_fd, NETRESOLVE_STATE_DONE, fd, events)) {
@@ -343,6 +504,10 @@ netresolve_query_dispatch(netresolve_query_t query, int fd, int events)
 			debug_query(query, "result timed out");
 			return true;
 		}
+		if (netresolve_offload_dispatch(query, fd))
+			return true;
+		if (netresolve_connect_dispatch(query, fd, events))
+			return true;
 		if (backend && backend->dispatch) {
 			backend->dispatch(query, fd, events);
 			if (query->state == NETRESOLVE_STATE_RESOLVED)
@@ -356,6 +521,7 @@ netresolve_query_dispatch(netresolve_query_t query, int fd, int events)
 	case NETRESOLVE_STATE_RESOLVED:
 		return dispatch_timeout(query, &query->delayed_fd, NETRESOLVE_STATE_DONE, fd, events);
 	case NETRESOLVE_STATE_DONE:
+	case NETRESOLVE_STATE_FAILED:
 		return netresolve_connect_dispatch(query, fd, events);
 	default:
 		break;
@@ -365,6 +531,79 @@ netresolve_query_dispatch(netresolve_query_t query, int fd, int events)
 	return false;
 }
 
+static void
+destroy_query(netresolve_query_t query)
+{
+	const struct netresolve_request *shared = query->template ? &query->template->request : NULL;
+
+	if (!shared || query->request.nodename != shared->nodename)
+		free(query->request.nodename);
+	if (!shared || query->request.servname != shared->servname)
+		free(query->request.servname);
+	if (!shared || query->request.dns_name != shared->dns_name)
+		free(query->request.dns_name);
+	if (query->template)
+		netresolve_template_unref(query->template);
+	netresolve_chain_unref(query->chain);
+	pthread_mutex_destroy(&query->lock);
+	free(query->extra);
+	netresolve_slab_free_query(query);
+}
+
+/* netresolve_query_get_extra:
+ *
+ * Storage for string output is only needed by some applications and
+ * backends. It's allocated on first use to keep queries small. Returns NULL
+ * when out of memory.
+ */
+struct netresolve_query_extra *
+netresolve_query_get_extra(netresolve_query_t query)
+{
+	if (!query->extra)
+		query->extra = calloc(1, sizeof *query->extra);
+
+	return query->extra;
+}
+
+/* netresolve_query_lock:
+ *
+ * Serialize dispatching of a query in a context shared by multiple
+ * dispatching threads. The lock is recursive so that the query can be
+ * freed from its own callback. This is a no-op in single-threaded contexts.
+ */
+void
+netresolve_query_lock(netresolve_query_t query)
+{
+	if (query->context->threaded)
+		pthread_mutex_lock(&query->lock);
+}
+
+void
+netresolve_query_unlock(netresolve_query_t query)
+{
+	if (query->context->threaded)
+		pthread_mutex_unlock(&query->lock);
+}
+
+/* netresolve_query_release:
+ *
+ * Drop a reference taken with the context lock held by a dispatching
+ * thread and destroy the query if it has been freed in the meantime.
+ */
+void
+netresolve_query_release(netresolve_query_t query)
+{
+	netresolve_t context = query->context;
+	bool destroy;
+
+	netresolve_context_lock(context);
+	destroy = !--query->refcount && query->freed;
+	netresolve_context_unlock(context);
+
+	if (destroy)
+		destroy_query(query);
+}
+
 /* netresolve_query_free:
  *
  * Call this function when you are finished with the netresolve query and
@@ -375,17 +614,33 @@ netresolve_query_dispatch(netresolve_query_t query, int fd, int events)
 void
 netresolve_query_free(netresolve_query_t query)
 {
+	netresolve_t context = query->context;
+	bool destroy;
+
+	netresolve_query_lock(query);
+
+	if (query->parent)
+		netresolve_speculation_cancel(query);
+
 	cleanup_query(query);
 
 	netresolve_query_set_state(query, NETRESOLVE_STATE_NONE);
 
+	/* Unlock first, a dispatching thread may destroy the query as soon as
+	 * it is marked as freed.
+	 */
+	netresolve_query_unlock(query);
+
+	netresolve_context_lock(context);
 	query->previous->next = query->next;
 	query->next->previous = query->previous;
+	query->freed = true;
+	destroy = !query->refcount;
+	netresolve_context_unlock(context);
 
-	free(query->request.nodename);
-	free(query->request.servname);
-	free(query->request.dns_name);
-	free(query);
+	/* Dispatching threads holding a reference finish the job. */
+	if (destroy)
+		destroy_query(query);
 }
 
 /* netresolve_query_get_count:
@@ -411,8 +666,12 @@ netresolve_query_get_node_info(netresolve_query_t query, size_t idx,
 
 	if (family)
 		*family = query->response.paths[idx].node.family;
-	if (address)
-		*address = &query->response.paths[idx].node.address;
+	if (address) {
+		if (query->response.paths[idx].node.family == AF_UNIX)
+			*address = query->response.unix_paths[query->response.paths[idx].node.unix_path];
+		else
+			*address = &query->response.paths[idx].node.address;
+	}
 	if (ifindex)
 		*ifindex = query->response.paths[idx].node.ifindex;
 }
@@ -0,0 +1,328 @@
+/* Copyright (c) 2013 Pavel Šimerda, Red Hat, Inc. (psimerda at redhat.com) and others
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <netresolve-private.h>
+#include <dlfcn.h>
+
+/* Backend modules are loaded once per process and shared by all contexts.
+ * Parsed backend strings are cached as well, so that creating a context
+ * and running its first query costs a lookup and a reference. Modules are
+ * only loaded when a query reaches the backend, so that a chain ending with
+ * a DNS backend doesn't pull in the DNS stack for queries answered locally.
+ * A few chains that are no longer used are kept around for contexts that
+ * come and go, like the ones created by the nsswitch module for each call.
+ */
+#define MAX_UNUSED_CHAINS 8
+
+struct netresolve_module {
+	struct netresolve_module *next;
+	char *name;
+	int refcount;
+	void *dl_handle;
+	void (*setup[_NETRSOLVE_REQUEST_TYPES])(netresolve_query_t query, char **settings);
+	void (*dispatch)(netresolve_query_t query, int fd, int revents);
+	void (*cleanup)(netresolve_query_t query);
+	bool blocking;
+};
+
+static struct {
+	pthread_mutex_t lock;
+	struct netresolve_module *modules;
+	struct netresolve_chain *chains;
+} registry = { PTHREAD_MUTEX_INITIALIZER };
+
+static struct netresolve_module *
+load_module(const char *name)
+{
+	const struct netresolve_builtin *builtin;
+	struct netresolve_module *module;
+	const bool *blocking;
+	char filename[1024];
+
+	for (module = registry.modules; module; module = module->next) {
+		if (!strcmp(module->name, name)) {
+			module->refcount++;
+			return module;
+		}
+	}
+
+	if (!(module = calloc(1, sizeof *module)))
+		return NULL;
+	if (!(module->name = strdup(name)))
+		goto fail;
+
+	if ((builtin = netresolve_builtin_lookup(name))) {
+		memcpy(module->setup, builtin->setup, sizeof module->setup);
+		module->dispatch = builtin->dispatch;
+		module->cleanup = builtin->cleanup;
+		module->blocking = builtin->blocking && *builtin->blocking;
+		goto out;
+	}
+
+	snprintf(filename, sizeof filename, "libnetresolve-backend-%s.so", name);
+	module->dl_handle = dlopen(filename, RTLD_NOW);
+	if (!module->dl_handle) {
+		error("%s", dlerror());
+		goto fail;
+	}
+
+	module->setup[NETRESOLVE_REQUEST_FORWARD] = dlsym(module->dl_handle, "setup_forward");
+	module->setup[NETRESOLVE_REQUEST_REVERSE] = dlsym(module->dl_handle, "setup_reverse");
+	module->setup[NETRESOLVE_REQUEST_DNS] = dlsym(module->dl_handle, "setup_dns");
+	module->dispatch = dlsym(module->dl_handle, "dispatch");
+	module->cleanup = dlsym(module->dl_handle, "cleanup");
+	blocking = dlsym(module->dl_handle, "blocking");
+	module->blocking = blocking && *blocking;
+out:
+	module->refcount = 1;
+	module->next = registry.modules;
+	registry.modules = module;
+
+	debug("loaded backend module: %s", name);
+
+	return module;
+fail:
+	free(module->name);
+	free(module);
+	return NULL;
+}
+
+static void
+unref_module(struct netresolve_module *module)
+{
+	struct netresolve_module **p;
+
+	if (--module->refcount)
+		return;
+
+	for (p = &registry.modules; *p != module; p = &(*p)->next)
+		;
+	*p = module->next;
+
+	debug("unloading backend module: %s", module->name);
+
+	if (module->dl_handle)
+		dlclose(module->dl_handle);
+	free(module->name);
+	free(module);
+}
+
+static void
+free_backend(struct netresolve_backend *backend)
+{
+	char **p;
+
+	if (!backend)
+		return;
+	if (backend->settings) {
+		for (p = backend->settings; *p; p++)
+			free(*p);
+		free(backend->settings);
+	}
+	if (backend->module)
+		unref_module(backend->module);
+	free(backend);
+}
+
+static struct netresolve_backend *
+parse_backend(char **take_settings)
+{
+	struct netresolve_backend *backend = calloc(1, sizeof *backend);
+
+	if (!backend)
+		return NULL;
+	if (!take_settings || !*take_settings)
+		goto fail;
+
+	backend->settings = take_settings;
+	backend->name = *take_settings;
+	if (*backend->name == '+') {
+		backend->mandatory = true;
+		backend->name++;
+	}
+
+	return backend;
+fail:
+	free_backend(backend);
+	return NULL;
+}
+
+static void
+free_chain(struct netresolve_chain *chain)
+{
+	struct netresolve_backend **backend;
+
+	for (backend = chain->backends; *backend; backend++)
+		free_backend(*backend);
+	free(chain->backends);
+	free(chain->string);
+	free(chain);
+}
+
+static struct netresolve_chain *
+parse_chain(const char *string)
+{
+	struct netresolve_chain *chain;
+	const char *setup, *end;
+	char **settings = NULL;
+	int nsettings = 0;
+	int nbackends = 0;
+
+	if (!(chain = calloc(1, sizeof *chain)))
+		return NULL;
+	if (!(chain->string = strdup(string)) || !(chain->backends = calloc(1, sizeof *chain->backends))) {
+		free(chain->string);
+		free(chain);
+		return NULL;
+	}
+
+	for (setup = end = string; true; end++) {
+		if (*end == ':' || *end == ',' || *end == '\0') {
+			settings = realloc(settings, (nsettings + 2) * sizeof *settings);
+			settings[nsettings++] = strndup(setup, end - setup);
+			settings[nsettings] = NULL;
+			setup = end + 1;
+		}
+		if (*end == ',' || *end == '\0') {
+			if (settings && *settings && **settings) {
+				chain->backends = realloc(chain->backends, (nbackends + 2) * sizeof *chain->backends);
+				chain->backends[nbackends] = parse_backend(settings);
+				if (chain->backends[nbackends])
+					nbackends++;
+				chain->backends[nbackends] = NULL;
+			} else {
+				char **p;
+
+				for (p = settings; p && *p; p++)
+					free(*p);
+				free(settings);
+			}
+			nsettings = 0;
+			settings = NULL;
+		}
+		if (*end == '\0') {
+			break;
+		}
+	}
+
+	return chain;
+}
+
+/* netresolve_chain_get:
+ *
+ * Retrieve a reference to the chain of backends described by the string,
+ * parsing it if needed.
+ */
+struct netresolve_chain *
+netresolve_chain_get(const char *string)
+{
+	struct netresolve_chain **p, *chain;
+
+	pthread_mutex_lock(&registry.lock);
+
+	for (p = &registry.chains; *p; p = &(*p)->next)
+		if (!strcmp((*p)->string, string))
+			break;
+
+	if ((chain = *p)) {
+		/* Move to front so that the least recently used chains are evicted. */
+		*p = chain->next;
+	} else if (!(chain = parse_chain(string))) {
+		pthread_mutex_unlock(&registry.lock);
+		return NULL;
+	}
+
+	chain->next = registry.chains;
+	registry.chains = chain;
+	__atomic_add_fetch(&chain->refcount, 1, __ATOMIC_RELAXED);
+
+	pthread_mutex_unlock(&registry.lock);
+
+	return chain;
+}
+
+struct netresolve_chain *
+netresolve_chain_ref(struct netresolve_chain *chain)
+{
+	__atomic_add_fetch(&chain->refcount, 1, __ATOMIC_RELAXED);
+
+	return chain;
+}
+
+void
+netresolve_chain_unref(struct netresolve_chain *chain)
+{
+	struct netresolve_chain **p;
+	int unused = 0;
+
+	if (__atomic_sub_fetch(&chain->refcount, 1, __ATOMIC_ACQ_REL))
+		return;
+
+	pthread_mutex_lock(&registry.lock);
+
+	/* References are only taken from zero with the registry locked. */
+	for (p = &registry.chains; *p;) {
+		chain = *p;
+		if (!__atomic_load_n(&chain->refcount, __ATOMIC_ACQUIRE) && ++unused > MAX_UNUSED_CHAINS) {
+			*p = chain->next;
+			free_chain(chain);
+		} else
+			p = &chain->next;
+	}
+
+	pthread_mutex_unlock(&registry.lock);
+}
+
+/* netresolve_module_load:
+ *
+ * Load the module implementing a backend when a query first reaches it.
+ * Returns false when the module is not available, in which case the
+ * backend is treated as failed from then on.
+ */
+bool
+netresolve_module_load(struct netresolve_backend *backend)
+{
+	struct netresolve_module *module;
+	int loaded = __atomic_load_n(&backend->loaded, __ATOMIC_ACQUIRE);
+
+	if (loaded)
+		return loaded > 0;
+
+	pthread_mutex_lock(&registry.lock);
+
+	if (!(loaded = backend->loaded)) {
+		if ((module = backend->module = load_module(backend->name))) {
+			memcpy(backend->setup, module->setup, sizeof backend->setup);
+			backend->dispatch = module->dispatch;
+			backend->cleanup = module->cleanup;
+			backend->blocking = module->blocking;
+			loaded = 1;
+		} else
+			loaded = -1;
+		__atomic_store_n(&backend->loaded, loaded, __ATOMIC_RELEASE);
+	}
+
+	pthread_mutex_unlock(&registry.lock);
+
+	return loaded > 0;
+}
@@ -88,6 +88,12 @@ netresolve_request_set_options_from_va(struct netresolve_request *request, va_li
 		case NETRESOLVE_OPTION_DNS_SRV_LOOKUP:
 			request->dns_srv_lookup = va_arg(ap, int);
 			break;
+		case NETRESOLVE_OPTION_ADDRCONFIG:
+			request->addrconfig = va_arg(ap, int);
+			break;
+		case NETRESOLVE_OPTION_PATH_CALLBACK:
+			request->path_callback = va_arg(ap, netresolve_path_callback);
+			break;
 		default:
 			return false;
 		}
@@ -106,6 +112,9 @@ get_option(struct netresolve_request *request, int option, void *argument)
 	case NETRESOLVE_OPTION_DNS_SRV_LOOKUP:
 		*(bool *) argument = request->dns_srv_lookup;
 		break;
+	case NETRESOLVE_OPTION_ADDRCONFIG:
+		*(bool *) argument = request->addrconfig;
+		break;
 	case NETRESOLVE_OPTION_NODE_NAME:
 		*(const char **) argument = request->nodename;
 		break;
@@ -140,6 +149,9 @@ get_option(struct netresolve_request *request, int option, void *argument)
 	case NETRESOLVE_OPTION_DNS_TYPE:
 		*(int *) argument = request->dns_type;
 		break;
+	case NETRESOLVE_OPTION_PATH_CALLBACK:
+		*(netresolve_path_callback *) argument = request->path_callback;
+		break;
 	default:
 		return false;
 	}
@@ -158,3 +170,73 @@ netresolve_request_get_options_from_va(struct netresolve_request *request, va_li
 
 	return true;
 }
+
+/* netresolve_request_new:
+ *
+ * Prepare a forward request to be used for many queries using
+ * `netresolve_request_forward()`. The request starts with the configuration
+ * of the context, options are given as a list terminated by
+ * `NETRESOLVE_OPTION_DONE`. Unlike with individual queries, the options
+ * are only parsed and validated once. Returns NULL on invalid options.
+ */
+netresolve_request_t
+netresolve_request_new(netresolve_t context, ...)
+{
+	struct netresolve_template *template;
+	struct netresolve_request *request;
+	va_list ap;
+	bool valid;
+
+	if (!(template = calloc(1, sizeof *template)))
+		return NULL;
+
+	template->context = context;
+	template->refcount = 1;
+	request = &template->request;
+	memcpy(request, &context->request, sizeof *request);
+	request->type = NETRESOLVE_REQUEST_FORWARD;
+	request->nodename = request->servname = request->dns_name = NULL;
+	copy_string(&request->nodename, context->request.nodename);
+	copy_string(&request->servname, context->request.servname);
+
+	va_start(ap, context);
+	valid = netresolve_request_set_options_from_va(request, ap);
+	va_end(ap);
+
+	if (!valid) {
+		netresolve_template_unref(template);
+		return NULL;
+	}
+
+	return template;
+}
+
+/* netresolve_request_free:
+ *
+ * Release the prepared request. Queries created from it keep working.
+ */
+void
+netresolve_request_free(netresolve_request_t request)
+{
+	netresolve_template_unref(request);
+}
+
+struct netresolve_template *
+netresolve_template_ref(struct netresolve_template *template)
+{
+	__atomic_add_fetch(&template->refcount, 1, __ATOMIC_RELAXED);
+
+	return template;
+}
+
+void
+netresolve_template_unref(struct netresolve_template *template)
+{
+	if (__atomic_sub_fetch(&template->refcount, 1, __ATOMIC_ACQ_REL))
+		return;
+
+	free(template->request.nodename);
+	free(template->request.servname);
+	free(template->request.dns_name);
+	free(template);
+}
@@ -0,0 +1,169 @@
+/* Copyright (c) 2013 Pavel Šimerda, Red Hat, Inc. (psimerda at redhat.com) and others
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <netresolve-private.h>
+#include <string.h>
+#include <time.h>
+
+/* Connection history
+ *
+ * A context remembers how connecting to recently used destination addresses
+ * went, so that `netresolve_connect()` can try the historically fastest
+ * addresses first and leave addresses that have just failed for last. The
+ * table is a small direct-mapped cache, a colliding destination simply
+ * replaces the older one.
+ *
+ * Both the round-trip time and the failure rate are exponentially weighted
+ * moving averages with a weight of 1/8 for each new sample.
+ */
+#define RTT_ENTRIES 256
+#define RTT_COOLDOWN 30000
+#define RATE_ONE 256
+
+struct netresolve_rtt {
+	struct netresolve_rtt_entry {
+		int family;
+		unsigned char address[sizeof (struct in6_addr)];
+		/* Smoothed round-trip time in microseconds, 0 for unknown */
+		long srtt;
+		/* Failure rate in 1/RATE_ONE units */
+		int rate;
+		/* Time of the last failure in milliseconds, 0 for none */
+		uint64_t failed;
+	} entries[RTT_ENTRIES];
+};
+
+static uint64_t
+now_ms(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return now.tv_sec * 1000ull + now.tv_nsec / 1000000;
+}
+
+static bool
+get_key(const struct sockaddr *sa, int *family, const void **address, size_t *length)
+{
+	switch (sa->sa_family) {
+	case AF_INET:
+		*address = &((const struct sockaddr_in *) sa)->sin_addr;
+		*length = sizeof (struct in_addr);
+		break;
+	case AF_INET6:
+		*address = &((const struct sockaddr_in6 *) sa)->sin6_addr;
+		*length = sizeof (struct in6_addr);
+		break;
+	default:
+		return false;
+	}
+
+	*family = sa->sa_family;
+	return true;
+}
+
+static struct netresolve_rtt_entry *
+get_entry(netresolve_t context, const struct sockaddr *sa, bool create)
+{
+	struct netresolve_rtt_entry *entry;
+	const unsigned char *address;
+	size_t length;
+	uint32_t hash = 2166136261u;
+	int family;
+	int i;
+
+	if (!get_key(sa, &family, (const void **) &address, &length))
+		return NULL;
+	if (!context->rtt && (!create || !(context->rtt = calloc(1, sizeof *context->rtt))))
+		return NULL;
+
+	for (i = 0; i < length; i++)
+		hash = (hash ^ address[i]) * 16777619u;
+	entry = &context->rtt->entries[(hash ^ family) % RTT_ENTRIES];
+
+	if (entry->family != family || memcmp(entry->address, address, length)) {
+		if (!create)
+			return NULL;
+		memset(entry, 0, sizeof *entry);
+		entry->family = family;
+		memcpy(entry->address, address, length);
+	}
+
+	return entry;
+}
+
+/* netresolve_rtt_update:
+ *
+ * Record the outcome of a connection attempt to `sa`. A negative `rtt`
+ * records a failure, otherwise it's the time in microseconds it took to
+ * connect.
+ */
+void
+netresolve_rtt_update(netresolve_t context, const struct sockaddr *sa, long rtt)
+{
+	struct netresolve_rtt_entry *entry;
+
+	netresolve_context_lock(context);
+
+	if ((entry = get_entry(context, sa, true))) {
+		if (rtt < 0) {
+			entry->rate += (RATE_ONE - entry->rate) / 8;
+			entry->failed = now_ms();
+		} else {
+			entry->rate -= entry->rate / 8;
+			entry->srtt = entry->srtt ? entry->srtt + (rtt - entry->srtt) / 8 : rtt;
+			if (!entry->srtt)
+				entry->srtt = 1;
+		}
+	}
+
+	netresolve_context_unlock(context);
+}
+
+/* netresolve_rtt_get_cost:
+ *
+ * Rank a destination address for a connection attempt, lower is better.
+ * Addresses that failed within the cool-down period come last, followed by
+ * addresses without history. Known addresses are ranked by their expected
+ * time to connect, taking retries after failures into account.
+ */
+long
+netresolve_rtt_get_cost(netresolve_t context, const struct sockaddr *sa)
+{
+	struct netresolve_rtt_entry *entry;
+	long cost = NETRESOLVE_RTT_UNKNOWN;
+
+	netresolve_context_lock(context);
+
+	if ((entry = get_entry(context, sa, false))) {
+		if (entry->failed && now_ms() - entry->failed < RTT_COOLDOWN)
+			cost = NETRESOLVE_RTT_FAILED;
+		else if (entry->srtt)
+			cost = entry->srtt * RATE_ONE / (RATE_ONE - entry->rate);
+	}
+
+	netresolve_context_unlock(context);
+
+	return cost;
+}
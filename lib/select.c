@@ -147,6 +147,7 @@ netresolve_select_dispatch_write(netresolve_t context, int fd)
 int
 netresolve_select_wait(netresolve_t context, struct timeval *timeout)
 {
+	struct netresolve_select *loop = netresolve_get_user_data(context);
 	fd_set rfds, wfds;
 	int nfds, status;
 	
@@ -156,10 +157,11 @@ netresolve_select_wait(netresolve_t context, struct timeval *timeout)
 
 	status = select(nfds, &rfds, &wfds, NULL, timeout);
 
+	/* Dispatching may remove other file descriptors from the set. */
 	for (int fd = 0; fd < nfds; fd++) {
-		if (FD_ISSET(fd, &rfds))
+		if (FD_ISSET(fd, &rfds) && fd < loop->nfds && FD_ISSET(fd, &loop->rfds))
 			netresolve_select_dispatch_read(context, fd);
-		if (FD_ISSET(fd, &wfds))
+		if (FD_ISSET(fd, &wfds) && fd < loop->nfds && FD_ISSET(fd, &loop->wfds))
 			netresolve_select_dispatch_write(context, fd);
 	}
 
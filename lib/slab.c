@@ -0,0 +1,178 @@
+/* Copyright (c) 2013 Pavel Šimerda, Red Hat, Inc. (psimerda at redhat.com) and others
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <netresolve-private.h>
+#include <stddef.h>
+
+/* Queries and backend private data are allocated for every name resolution
+ * and released shortly afterwards. Instead of going through the allocator
+ * each time, a context keeps released memory on free lists. Queries are
+ * allocated in slabs of several queries, backend data is rounded up to a
+ * few size classes. Everything is returned when the context is freed.
+ */
+#define QUERIES_PER_SLAB 16
+#define MIN_BLOCK_SIZE 64
+
+struct netresolve_slab {
+	struct netresolve_slab *next;
+	struct netresolve_query queries[QUERIES_PER_SLAB];
+};
+
+struct netresolve_block {
+	struct netresolve_block *next;
+	int class;
+	max_align_t data[];
+};
+
+/* netresolve_slab_alloc_query:
+ *
+ * Get zeroed memory for a new query of the context.
+ */
+netresolve_query_t
+netresolve_slab_alloc_query(netresolve_t context)
+{
+	struct netresolve_slab *slab;
+	netresolve_query_t query;
+	int i;
+
+	netresolve_context_lock(context);
+
+	if (!context->slab.queries) {
+		if (!(slab = malloc(sizeof *slab))) {
+			netresolve_context_unlock(context);
+			return NULL;
+		}
+		slab->next = context->slab.slabs;
+		context->slab.slabs = slab;
+		for (i = 0; i < QUERIES_PER_SLAB; i++) {
+			slab->queries[i].next = context->slab.queries;
+			context->slab.queries = &slab->queries[i];
+		}
+	}
+
+	query = context->slab.queries;
+	context->slab.queries = query->next;
+
+	netresolve_context_unlock(context);
+
+	memset(query, 0, sizeof *query);
+
+	return query;
+}
+
+void
+netresolve_slab_free_query(netresolve_query_t query)
+{
+	netresolve_t context = query->context;
+
+	netresolve_context_lock(context);
+	query->next = context->slab.queries;
+	context->slab.queries = query;
+	netresolve_context_unlock(context);
+}
+
+/* netresolve_slab_alloc_priv:
+ *
+ * Get zeroed memory for backend private data. Queries that don't belong
+ * to a context, like the ones running a setup in a worker thread, get
+ * their memory directly from the allocator.
+ */
+void *
+netresolve_slab_alloc_priv(netresolve_t context, size_t size)
+{
+	struct netresolve_block *block = NULL;
+	int class;
+
+	for (class = 0; class < NETRESOLVE_BLOCK_CLASSES; class++)
+		if (size <= MIN_BLOCK_SIZE << class)
+			break;
+
+	if (!context || class == NETRESOLVE_BLOCK_CLASSES) {
+		if (!(block = calloc(1, offsetof(struct netresolve_block, data) + size)))
+			return NULL;
+		block->class = -1;
+		return block->data;
+	}
+
+	netresolve_context_lock(context);
+	if ((block = context->slab.blocks[class]))
+		context->slab.blocks[class] = block->next;
+	netresolve_context_unlock(context);
+
+	if (!block) {
+		if (!(block = malloc(offsetof(struct netresolve_block, data) + (MIN_BLOCK_SIZE << class))))
+			return NULL;
+		block->class = class;
+	}
+
+	memset(block->data, 0, size);
+
+	return block->data;
+}
+
+void
+netresolve_slab_free_priv(netresolve_t context, void *priv)
+{
+	struct netresolve_block *block;
+
+	if (!priv)
+		return;
+
+	block = (void *) ((char *) priv - offsetof(struct netresolve_block, data));
+
+	if (block->class == -1) {
+		free(block);
+		return;
+	}
+
+	netresolve_context_lock(context);
+	block->next = context->slab.blocks[block->class];
+	context->slab.blocks[block->class] = block;
+	netresolve_context_unlock(context);
+}
+
+/* netresolve_slab_clear:
+ *
+ * Return all memory kept by the context. Must be called after all queries
+ * of the context have been destroyed.
+ */
+void
+netresolve_slab_clear(netresolve_t context)
+{
+	struct netresolve_slab *slab;
+	struct netresolve_block *block;
+	int class;
+
+	while ((slab = context->slab.slabs)) {
+		context->slab.slabs = slab->next;
+		free(slab);
+	}
+	context->slab.queries = NULL;
+
+	for (class = 0; class < NETRESOLVE_BLOCK_CLASSES; class++) {
+		while ((block = context->slab.blocks[class])) {
+			context->slab.blocks[class] = block->next;
+			free(block);
+		}
+	}
+}
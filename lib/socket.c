@@ -22,79 +22,310 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 #include <unistd.h>
+#include <time.h>
+#include <netinet/tcp.h>
+#include <linux/filter.h>
 
 #include "netresolve-private.h"
 
-#define FIRST_CONNECT_TIMEOUT 1
+/* Happy Eyeballs (RFC 8305)
+ *
+ * Connection attempts start as soon as the first path is available, even
+ * while the resolution is still waiting for more. Attempts alternate between
+ * address families and each one gets a head start of `connect_delay`
+ * milliseconds before the next one is started. A failed attempt lets the
+ * next one start right away. The first socket to connect wins and all other
+ * attempts are cancelled.
+ *
+ * Attempts keep their own copy of the address as paths are sorted once the
+ * resolution is finished. Their outcome is recorded in the connection
+ * history of the context, which then affects the order of addresses.
+ *
+ * An initial payload is sent along with the SYN of each TCP attempt using
+ * TCP Fast Open when the kernel has a cookie for the destination. Without
+ * a cookie the kernel asks for one and the payload is left to the caller.
+ * As attempts race, the payload may reach more than one server.
+ *
+ * In connect-to-all mode, every path is connected and each connected socket
+ * is reported. Instead of head starts, the number of concurrent attempts is
+ * limited and each attempt has its own timeout.
+ */
+struct netresolve_connection {
+	enum netresolve_state state;
+	int fd;
+	struct netresolve_sockaddr address;
+	struct timespec started;
+	int timeout;
+	size_t sent;
+};
 
 struct netresolve_socket {
 	netresolve_query_t query;
 	netresolve_socket_callback_t callback;
+	netresolve_socket_set_callback_t set_callback;
 	void *user_data;
 	int flags;
-	int first_connect_timeout;
+	int delay_timeout;
+	bool resolved;
+	bool report_failure;
+	void *payload;
+	size_t payload_size;
+	size_t sent;
+	struct netresolve_connection *connections;
+	size_t nconnections;
+	int count;
+	bool per_cpu;
+	bool all;
+	int limit;
+	int attempt_timeout;
 };
 
-static void
-do_connect(netresolve_query_t query, size_t idx)
+static void connect_callback(netresolve_query_t query, void *user_data);
+
+static bool
+same_address(const struct netresolve_sockaddr *a, const struct netresolve_sockaddr *b)
+{
+	return a->salen == b->salen && a->socktype == b->socktype && a->protocol == b->protocol &&
+			!memcmp(&a->sa, &b->sa, a->salen);
+}
+
+static bool
+is_attempted(const struct netresolve_socket *data, const struct netresolve_sockaddr *address)
+{
+	int i;
+
+	for (i = 0; i < data->nconnections; i++)
+		if (same_address(&data->connections[i].address, address))
+			return true;
+
+	return false;
+}
+
+/* Pick the path not attempted yet with the best connection history,
+ * preferring a different address family than the one of the last attempt.
+ * Paths with the same history are taken in order. Paths that have failed
+ * recently wait for the resolution to finish as better ones may follow.
+ */
+static const struct netresolve_sockaddr *
+next_address(const struct netresolve_socket *data)
+{
+	netresolve_t context = data->query->context;
+	size_t count;
+	const struct netresolve_sockaddr *sockaddrs = netresolve_query_get_sockaddrs(data->query, &count);
+	const struct netresolve_sockaddr *candidate = NULL;
+	int last_family = data->nconnections ? data->connections[data->nconnections - 1].address.sa.ss_family : AF_UNSPEC;
+	bool other_family = false;
+	long best = 0;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		bool other = sockaddrs[i].sa.ss_family != last_family;
+		long cost;
+
+		if (!sockaddrs[i].salen || is_attempted(data, &sockaddrs[i]))
+			continue;
+		if (other_family && !other)
+			continue;
+
+		cost = netresolve_rtt_get_cost(context, (const struct sockaddr *) &sockaddrs[i].sa);
+		if (cost == NETRESOLVE_RTT_FAILED && !data->resolved)
+			continue;
+		if (!candidate || (other && !other_family) || cost < best) {
+			candidate = &sockaddrs[i];
+			other_family = other;
+			best = cost;
+		}
+	}
+
+	return candidate;
+}
+
+static long
+elapsed_us(const struct timespec *since)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec - since->tv_sec) * 1000000L + (now.tv_nsec - since->tv_nsec) / 1000;
+}
+
+/* Start a TCP connection carrying the payload in its SYN. Behaves like
+ * `connect()` on a nonblocking socket except that it fails with EOPNOTSUPP
+ * when Fast Open is not available.
+ */
+static int
+fastopen_connect(struct netresolve_socket *data, struct netresolve_connection *connection)
+{
+#ifdef MSG_FASTOPEN
+	const struct netresolve_sockaddr *address = &connection->address;
+	ssize_t sent;
+
+	sent = sendto(connection->fd, data->payload, data->payload_size, MSG_FASTOPEN | MSG_NOSIGNAL,
+			(const struct sockaddr *) &address->sa, address->salen);
+	if (sent == -1)
+		return -1;
+
+	connection->sent = sent;
+	return 0;
+#else
+	errno = EOPNOTSUPP;
+	return -1;
+#endif
+}
+
+/* Record a new attempt before it is started so that a failed attempt is
+ * never retried. Returns NULL when out of memory.
+ */
+static struct netresolve_connection *
+add_connection(struct netresolve_socket *data, const struct netresolve_sockaddr *address)
+{
+	struct netresolve_connection *connection;
+	void *connections;
+
+	if (!(connections = realloc(data->connections, (data->nconnections + 1) * sizeof *data->connections)))
+		return NULL;
+	data->connections = connections;
+	connection = &data->connections[data->nconnections++];
+	connection->address = *address;
+	connection->state = NETRESOLVE_STATE_FAILED;
+	connection->fd = -1;
+	connection->timeout = -1;
+
+	return connection;
+}
+
+static bool
+do_connect(struct netresolve_socket *data, struct netresolve_connection *connection)
 {
 	static const int flags = O_NONBLOCK;
-	int socktype;
-	int protocol;
-	const struct sockaddr *sa;
-	socklen_t salen;
-	struct netresolve_path *path = &query->response.paths[idx];
+	netresolve_query_t query = data->query;
+	const struct netresolve_sockaddr *address = &connection->address;
+	int status;
+
+	connection->fd = socket(address->sa.ss_family, address->socktype | flags, address->protocol);
+	if (connection->fd == -1)
+		return false;
+	clock_gettime(CLOCK_MONOTONIC, &connection->started);
+	connection->sent = 0;
+	status = -1;
+	errno = EOPNOTSUPP;
+	if (data->payload && address->socktype == SOCK_STREAM)
+		status = fastopen_connect(data, connection);
+	if (status == -1 && errno == EOPNOTSUPP)
+		status = connect(connection->fd, (const struct sockaddr *) &address->sa, address->salen);
+	if (status == -1 && errno != EINPROGRESS) {
+		netresolve_rtt_update(query->context, (const struct sockaddr *) &address->sa, -1);
+		close(connection->fd);
+		connection->fd = -1;
+		return false;
+	}
+
+	netresolve_watch_fd(query, connection->fd, POLLOUT);
+	if (data->attempt_timeout > 0)
+		connection->timeout = netresolve_add_timeout_ms(query, data->attempt_timeout);
+	connection->state = NETRESOLVE_STATE_WAITING;
+	return true;
+}
+
+static void
+stop_attempt(struct netresolve_socket *data, struct netresolve_connection *connection)
+{
+	netresolve_unwatch_fd(data->query, connection->fd);
+	if (connection->timeout != -1) {
+		netresolve_remove_timeout(data->query, connection->timeout);
+		connection->timeout = -1;
+	}
+}
+
+static int
+count_attempts(const struct netresolve_socket *data)
+{
+	int count = 0;
+	int i;
+
+	for (i = 0; i < data->nconnections; i++)
+		if (data->connections[i].state == NETRESOLVE_STATE_WAITING)
+			count++;
+
+	return count;
+}
+
+/* Start the next attempt and give it a head start. */
+static void
+connect_next(struct netresolve_socket *data)
+{
+	netresolve_query_t query = data->query;
+	const struct netresolve_sockaddr *address;
+	struct netresolve_connection *connection;
 
-	if (path->socket.state != NETRESOLVE_STATE_NONE)
+	if (data->delay_timeout != -1) {
+		netresolve_remove_timeout(query, data->delay_timeout);
+		data->delay_timeout = -1;
+	}
+
+	if (data->all) {
+		while ((data->limit <= 0 || count_attempts(data) < data->limit) && (address = next_address(data))) {
+			if (!(connection = add_connection(data, address)))
+				goto fail;
+			do_connect(data, connection);
+		}
 		return;
+	}
 
-	sa = netresolve_query_get_sockaddr(query, path - query->response.paths, &salen, &socktype, &protocol, NULL);
-	if (!sa)
-		goto fail;
-	path->socket.fd = socket(sa->sa_family, socktype | flags, protocol);
-	if (path->socket.fd == -1)
-		goto fail;
-	if (connect(path->socket.fd, sa, salen) == -1 && errno != EINPROGRESS)
-		goto fail_connect;
-
-	netresolve_watch_fd(query, path->socket.fd, POLLOUT);
-	path->socket.state = NETRESOLVE_STATE_WAITING;
+	while ((address = next_address(data))) {
+		if (!(connection = add_connection(data, address)))
+			goto fail;
+		if (!do_connect(data, connection))
+			continue;
+		if (query->request.connect_delay <= 0)
+			continue;
+		data->delay_timeout = netresolve_add_timeout_ms(query, query->request.connect_delay);
+		break;
+	}
 	return;
-
-fail_connect:
-	close(path->socket.fd);
-	path->socket.fd = -1;
 fail:
-	path->socket.state = NETRESOLVE_STATE_FAILED;
+	error("socket: cannot record connection attempt: %s", strerror(errno));
 }
 
-static void
-connect_callback(netresolve_query_t query, void *user_data)
+/* netresolve_connect_update:
+ *
+ * Called when paths are added to a query that hasn't finished yet, so that
+ * `netresolve_connect()` can start connecting before the resolution is done.
+ */
+void
+netresolve_connect_update(netresolve_query_t query)
 {
-	struct netresolve_socket *data = user_data;
-	bool ip4 = false;
-	bool ip6 = false;
-	int i;
+	struct netresolve_socket *data = query->user_data;
 
-	debug_query(query, "socket: connecting");
+	if (query->callback != connect_callback)
+		return;
 
 	data->query = query;
-	data->first_connect_timeout = -1;
-	/* `data` is already stored in `query->user_data`. */
 
-	for (i = 0; i < query->response.pathcount; i++) {
-		struct netresolve_path *path = &query->response.paths[i];
+	if (data->delay_timeout == -1)
+		connect_next(data);
+}
 
-		if (!ip4 && path->node.family == AF_INET && path->socket.state == NETRESOLVE_STATE_NONE) {
-			do_connect(query, path - query->response.paths);
-			ip4 = true;
-		}
-		if (!ip6 && path->node.family == AF_INET6 && path->socket.state == NETRESOLVE_STATE_NONE) {
-			do_connect(query, path - query->response.paths);
-			ip6 = true;
-		}
+static int
+bind_socket(const struct sockaddr *sa, socklen_t salen, int socktype, int protocol, bool reuseport)
+{
+	int flags = O_NONBLOCK;
+	int sock;
+
+	sock = socket(sa->sa_family, socktype | flags, protocol);
+	if (sock == -1)
+		return -1;
+	if (reuseport && setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &(int) { 1 }, sizeof (int)) == -1) {
+		close(sock);
+		return -1;
+	}
+	if (bind(sock, sa, salen) == -1) {
+		close(sock);
+		return -1;
 	}
 
+	return sock;
 }
 
 static void
@@ -104,7 +335,6 @@ bind_callback(netresolve_query_t query, void *user_data)
 	size_t count = netresolve_query_get_count(query);
 
 	for (size_t idx = 0; idx < count; idx++) {
-		int flags = O_NONBLOCK;
 		int socktype;
 		int protocol;
 		const struct sockaddr *sa;
@@ -114,13 +344,9 @@ bind_callback(netresolve_query_t query, void *user_data)
 		sa = netresolve_query_get_sockaddr(query, idx, &salen, &socktype, &protocol, NULL);
 		if (!sa)
 			return;
-		sock = socket(sa->sa_family, socktype | flags, protocol);
+		sock = bind_socket(sa, salen, socktype, protocol, false);
 		if (sock == -1)
 			return;
-		if (bind(sock, sa, salen) == -1) {
-			close(sock);
-			return;
-		}
 		fcntl(sock, F_SETFL, (fcntl(sock, F_GETFL, 0) & ~(SOCK_NONBLOCK | SOCK_CLOEXEC)) | data->flags);
 
 		data->callback(query, idx, sock, data->user_data);
@@ -130,6 +356,74 @@ bind_callback(netresolve_query_t query, void *user_data)
 	netresolve_query_free(query);
 }
 
+/* Let the kernel pick the socket of a reuseport group by the CPU that
+ * received the packet. Sockets are indexed in the order they joined the
+ * group, i.e. by `bind()` for UDP and by `listen()` for TCP. A TCP socket
+ * with a program attached before `listen()` can no longer join the group.
+ */
+static bool
+attach_cpu_program(int sock, int count)
+{
+	struct sock_filter code[] = {
+		{ BPF_LD | BPF_W | BPF_ABS, 0, 0, SKF_AD_OFF + SKF_AD_CPU },
+		{ BPF_ALU | BPF_MOD | BPF_K, 0, 0, count },
+		{ BPF_RET | BPF_A, 0, 0, 0 },
+	};
+	struct sock_fprog program = { .len = sizeof code / sizeof *code, .filter = code };
+
+	return setsockopt(sock, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &program, sizeof program) == 0;
+}
+
+static void
+bind_set_callback(netresolve_query_t query, void *user_data)
+{
+	struct netresolve_socket *data = user_data;
+	size_t count = netresolve_query_get_count(query);
+	int *socks;
+
+	if (!(socks = calloc(data->count, sizeof *socks))) {
+		error("socket: cannot allocate %d sockets: %s", data->count, strerror(errno));
+		count = 0;
+	}
+
+	for (size_t idx = 0; idx < count; idx++) {
+		int socktype;
+		int protocol;
+		const struct sockaddr *sa;
+		socklen_t salen;
+		int i;
+
+		sa = netresolve_query_get_sockaddr(query, idx, &salen, &socktype, &protocol, NULL);
+		if (!sa)
+			continue;
+
+		for (i = 0; i < data->count; i++) {
+			if ((socks[i] = bind_socket(sa, salen, socktype, protocol, true)) == -1)
+				break;
+			if (socktype == SOCK_STREAM && listen(socks[i], SOMAXCONN) == -1) {
+				close(socks[i]);
+				break;
+			}
+			fcntl(socks[i], F_SETFL, (fcntl(socks[i], F_GETFL, 0) & ~(SOCK_NONBLOCK | SOCK_CLOEXEC)) | data->flags);
+		}
+		if (i < data->count) {
+			error("socket: cannot bind %d sockets: %s", data->count, strerror(errno));
+			while (i--)
+				close(socks[i]);
+			continue;
+		}
+
+		if (data->per_cpu && !attach_cpu_program(socks[0], data->count))
+			debug_query(query, "socket: cannot attach reuseport program: %s", strerror(errno));
+
+		data->set_callback(query, idx, socks, data->count, data->user_data);
+	}
+
+	free(socks);
+	free(data);
+	netresolve_query_free(query);
+}
+
 static void *
 memdup(const void *source, size_t len)
 {
@@ -149,113 +443,313 @@ do_cleanup(struct netresolve_socket *data)
 
 	debug("socket: cleaning up...");
 
-	for (i = 0; i < query->response.pathcount; i++) {
-		struct netresolve_path *path = &query->response.paths[i];
-
-		switch (path->socket.state) {
-		case NETRESOLVE_STATE_WAITING:
-		case NETRESOLVE_STATE_DONE:
-			netresolve_unwatch_fd(query, path->socket.fd);
-			close(path->socket.fd);
-			/* pass through */
-		default:
-			memset(&path->socket, 0, sizeof path->socket);
+	for (i = 0; i < data->nconnections; i++) {
+		struct netresolve_connection *connection = &data->connections[i];
+
+		if (connection->state == NETRESOLVE_STATE_WAITING) {
+			stop_attempt(data, connection);
+			close(connection->fd);
 		}
 	}
 
-	if (data->first_connect_timeout != -1) {
-		netresolve_remove_timeout(query, data->first_connect_timeout);
-		data->first_connect_timeout = -1;
-	}
+	if (data->delay_timeout != -1)
+		netresolve_remove_timeout(query, data->delay_timeout);
 
+	free(data->connections);
+	free(data->payload);
 	free(data);
 	netresolve_query_free(query);
 }
 
+static bool
+is_connecting(const struct netresolve_socket *data)
+{
+	int i;
+
+	if (data->delay_timeout != -1)
+		return true;
+
+	for (i = 0; i < data->nconnections; i++)
+		if (data->connections[i].state == NETRESOLVE_STATE_WAITING)
+			return true;
+
+	return false;
+}
+
+/* Give up when the resolution is finished and all attempts failed, or in
+ * connect-to-all mode, when all attempts are finished.
+ */
 static void
 connect_check(struct netresolve_socket *data)
 {
-	netresolve_query_t query = data->query;
-	int idx;
+	if (!data->resolved || is_connecting(data))
+		return;
 
-	for (idx = 0; idx < query->response.pathcount; idx++) {
-		struct netresolve_path *path = &query->response.paths[idx];
+	debug_query(data->query, "socket: no more connection attempts");
+	if (data->report_failure || data->all)
+		data->callback(data->query, -1, -1, data->user_data);
+	do_cleanup(data);
+}
 
-		if (path->socket.state < NETRESOLVE_STATE_DONE)
-			break;
+static void
+connect_callback(netresolve_query_t query, void *user_data)
+{
+	struct netresolve_socket *data = user_data;
 
-		if (path->socket.state == NETRESOLVE_STATE_DONE) {
-			int sock = path->socket.fd;
+	debug_query(query, "socket: resolution finished");
 
-			netresolve_unwatch_fd(query, sock);
-			fcntl(sock, F_SETFL, (fcntl(sock, F_GETFL, 0) & ~(SOCK_NONBLOCK | SOCK_CLOEXEC)) | data->flags);
-			data->callback(query, idx, sock, data->user_data);
-			path->socket.state = NETRESOLVE_STATE_NONE;
-			do_cleanup(data);
-			break;
-		}
-	}
+	data->query = query;
+	data->resolved = true;
+
+	if (data->delay_timeout == -1)
+		connect_next(data);
+
+	/* The query must not be freed from its own callback, give up later. */
+	if (!is_connecting(data))
+		data->delay_timeout = netresolve_add_timeout(query, 0, 1);
 }
 
 static void
-connect_finished(struct netresolve_socket *data, struct netresolve_path *path)
+connect_finished(struct netresolve_socket *data, size_t idx)
 {
 	netresolve_query_t query = data->query;
+	struct netresolve_connection *connection = &data->connections[idx];
+	const struct netresolve_sockaddr *sockaddrs;
+	size_t count;
+	int sock = connection->fd;
+	int i;
 
-	path->socket.state = NETRESOLVE_STATE_DONE;
+	/* Report the index of the path as it is now. */
+	sockaddrs = netresolve_query_get_sockaddrs(query, &count);
+	for (i = 0; i < count; i++)
+		if (same_address(&sockaddrs[i], &connection->address))
+			break;
 
-	if (data->first_connect_timeout == -1)
-		data->first_connect_timeout = netresolve_add_timeout(query, FIRST_CONNECT_TIMEOUT, 0);
+	netresolve_rtt_update(query->context, (const struct sockaddr *) &connection->address.sa, elapsed_us(&connection->started));
+	stop_attempt(data, connection);
+	connection->state = NETRESOLVE_STATE_DONE;
+	data->sent = connection->sent;
+#ifdef TCPI_OPT_SYN_DATA
+	if (data->sent) {
+		struct tcp_info info;
+		socklen_t len = sizeof info;
+
+		if (getsockopt(sock, IPPROTO_TCP, TCP_INFO, &info, &len) == 0)
+			debug_query(query, "socket: payload %s in SYN", (info.tcpi_options & TCPI_OPT_SYN_DATA) ? "accepted" : "not accepted");
+	}
+#endif
+	fcntl(sock, F_SETFL, (fcntl(sock, F_GETFL, 0) & ~(SOCK_NONBLOCK | SOCK_CLOEXEC)) | data->flags);
+	data->callback(query, i < count ? i : -1, sock, data->user_data);
 
-	connect_check(data);
+	if (data->all) {
+		connect_next(data);
+		connect_check(data);
+	} else
+		do_cleanup(data);
 }
 
 static void
-connect_failed(struct netresolve_socket *data, struct netresolve_path *path)
+connect_failed(struct netresolve_socket *data, size_t idx)
 {
-	netresolve_query_t query = data->query;
-	int family = path->node.family;
-
-	path->socket.state = NETRESOLVE_STATE_FAILED;
-	close(path->socket.fd);
+	struct netresolve_connection *connection = &data->connections[idx];
 
-	while (path < query->response.paths + query->response.pathcount)
-		if (path->node.family == family)
-			do_connect(query, path - query->response.paths);
+	netresolve_rtt_update(data->query->context, (const struct sockaddr *) &connection->address.sa, -1);
+	stop_attempt(data, connection);
+	close(connection->fd);
+	connection->fd = -1;
+	connection->state = NETRESOLVE_STATE_FAILED;
 
+	connect_next(data);
 	connect_check(data);
 }
 
+static netresolve_query_t
+start_connect(netresolve_t context,
+		const char *nodename, const char *servname,
+		int family, int socktype, int protocol,
+		const struct netresolve_socket *data)
+{
+	return netresolve_query(context, connect_callback, memdup(data, sizeof *data),
+			NETRESOLVE_REQUEST_FORWARD,
+			NETRESOLVE_OPTION_NODE_NAME, nodename,
+			NETRESOLVE_OPTION_SERVICE_NAME, servname,
+			NETRESOLVE_OPTION_FAMILY, family,
+			NETRESOLVE_OPTION_SOCKTYPE, socktype,
+			NETRESOLVE_OPTION_PROTOCOL, protocol,
+			NETRESOLVE_OPTION_DEFAULT_LOOPBACK, true,
+			NULL);
+}
+
+/* netresolve_connect_start:
+ *
+ * Internal variant of `netresolve_connect()` that can also report failure
+ * by calling the callback with `sock` set to -1.
+ */
+netresolve_query_t
+netresolve_connect_start(netresolve_t context,
+		const char *nodename, const char *servname,
+		int family, int socktype, int protocol,
+		const void *payload, size_t size,
+		netresolve_socket_callback_t callback, void *user_data, bool report_failure)
+{
+	int flags = socktype & (SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+	struct netresolve_socket data = {
+		.callback = callback,
+		.user_data = user_data,
+		.flags = flags,
+		.delay_timeout = -1,
+		.report_failure = report_failure,
+		.payload_size = size,
+	};
+
+	if (size && !(data.payload = memdup(payload, size)))
+		return NULL;
+
+	return start_connect(context, nodename, servname, family, socktype & ~flags, protocol, &data);
+}
+
 netresolve_query_t
 netresolve_connect(netresolve_t context,
 		const char *nodename, const char *servname,
 		int family, int socktype, int protocol,
 		netresolve_socket_callback_t callback, void *user_data)
+{
+	return netresolve_connect_start(context, nodename, servname, family, socktype, protocol,
+			NULL, 0, callback, user_data, false);
+}
+
+/* netresolve_connect_with_data:
+ *
+ * Like `netresolve_connect()` but try to send `size` bytes of `payload`
+ * along with the connection request using TCP Fast Open. The callback can
+ * use `netresolve_connect_get_sent()` to find out how much of the payload
+ * has already been sent and has to send the rest itself. The payload may
+ * be sent to more than one address, use it for idempotent requests only.
+ */
+netresolve_query_t
+netresolve_connect_with_data(netresolve_t context,
+		const char *nodename, const char *servname,
+		int family, int socktype, int protocol,
+		const void *payload, size_t size,
+		netresolve_socket_callback_t callback, void *user_data)
+{
+	return netresolve_connect_start(context, nodename, servname, family, socktype, protocol,
+			payload, size, callback, user_data, false);
+}
+
+/* netresolve_connect_all:
+ *
+ * Connect to all addresses of the service instead of just the first one
+ * that answers. At most `limit` attempts run at the same time, unlimited
+ * when `limit` is zero, and an attempt is abandoned after `timeout`
+ * milliseconds, never when `timeout` is zero. The callback is called for
+ * each connected socket as soon as it's ready and once more with `sock`
+ * set to -1 when all attempts are finished.
+ */
+netresolve_query_t
+netresolve_connect_all(netresolve_t context,
+		const char *nodename, const char *servname,
+		int family, int socktype, int protocol,
+		int limit, int timeout,
+		netresolve_socket_callback_t callback, void *user_data)
 {
 	int flags = socktype & (SOCK_NONBLOCK | SOCK_CLOEXEC);
 
+	struct netresolve_socket data = {
+		.callback = callback,
+		.user_data = user_data,
+		.flags = flags,
+		.delay_timeout = -1,
+		.all = true,
+		.limit = limit,
+		.attempt_timeout = timeout,
+	};
+
+	return start_connect(context, nodename, servname, family, socktype & ~flags, protocol, &data);
+}
+
+/* netresolve_connect_get_sent:
+ *
+ * Returns the number of payload bytes sent on the connected socket. Only
+ * valid from within the callback of `netresolve_connect_with_data()`.
+ */
+size_t
+netresolve_connect_get_sent(netresolve_query_t query)
+{
+	struct netresolve_socket *data;
+
+	if (!query || query->callback != connect_callback)
+		return 0;
+
+	data = query->user_data;
+
+	return data->sent;
+}
+
+/* netresolve_connect_cancel:
+ *
+ * Stop connecting and free a query started by `netresolve_connect()`
+ * without calling its callback.
+ */
+void
+netresolve_connect_cancel(netresolve_query_t query)
+{
+	struct netresolve_socket *data = query->user_data;
+
+	data->query = query;
+	do_cleanup(data);
+}
+
+netresolve_query_t
+netresolve_bind(netresolve_t context,
+		const char *nodename, const char *servname,
+		int family, int socktype, int protocol,
+		netresolve_socket_callback_t callback, void *user_data)
+{
 	struct netresolve_socket data = { .callback = callback, .user_data = user_data, .flags = socktype & (SOCK_NONBLOCK | SOCK_CLOEXEC) };
 
-	return netresolve_query(context, connect_callback, memdup(&data, sizeof data),
+	return netresolve_query(context, bind_callback, memdup(&data, sizeof data),
 			NETRESOLVE_REQUEST_FORWARD,
 			NETRESOLVE_OPTION_NODE_NAME, nodename,
 			NETRESOLVE_OPTION_SERVICE_NAME, servname,
 			NETRESOLVE_OPTION_FAMILY, family,
-			NETRESOLVE_OPTION_SOCKTYPE, socktype & ~flags,
+			NETRESOLVE_OPTION_SOCKTYPE, socktype & ~data.flags,
 			NETRESOLVE_OPTION_PROTOCOL, protocol,
-			NETRESOLVE_OPTION_DEFAULT_LOOPBACK, true,
+			NETRESOLVE_OPTION_DEFAULT_LOOPBACK, false,
 			NULL);
 }
 
+/* netresolve_bind_set:
+ *
+ * Like `netresolve_bind()` but create `count` sockets bound to each address
+ * with `SO_REUSEPORT` so that the kernel spreads incoming connections and
+ * datagrams among them. Stream sockets are already listening. The sockets
+ * of each address are passed to a single callback call. With `per_cpu`
+ * set, a socket is chosen by the CPU that handles the packet, which suits
+ * one thread per CPU.
+ */
 netresolve_query_t
-netresolve_bind(netresolve_t context,
+netresolve_bind_set(netresolve_t context,
 		const char *nodename, const char *servname,
 		int family, int socktype, int protocol,
-		netresolve_socket_callback_t callback, void *user_data)
+		int count, bool per_cpu,
+		netresolve_socket_set_callback_t callback, void *user_data)
 {
-	struct netresolve_socket data = { .callback = callback, .user_data = user_data, .flags = socktype & (SOCK_NONBLOCK | SOCK_CLOEXEC) };
+	struct netresolve_socket data = {
+		.set_callback = callback,
+		.user_data = user_data,
+		.flags = socktype & (SOCK_NONBLOCK | SOCK_CLOEXEC),
+		.count = count,
+		.per_cpu = per_cpu,
+	};
+
+	if (count <= 0) {
+		errno = EINVAL;
+		return NULL;
+	}
 
-	return netresolve_query(context, bind_callback, memdup(&data, sizeof data),
+	return netresolve_query(context, bind_set_callback, memdup(&data, sizeof data),
 			NETRESOLVE_REQUEST_FORWARD,
 			NETRESOLVE_OPTION_NODE_NAME, nodename,
 			NETRESOLVE_OPTION_SERVICE_NAME, servname,
@@ -266,49 +760,50 @@ netresolve_bind(netresolve_t context,
 			NULL);
 }
 
+/* netresolve_connect_dispatch:
+ *
+ * Handle events of connection attempts. Returns `false` for file
+ * descriptors that don't belong to `netresolve_connect()`.
+ */
 bool
 netresolve_connect_dispatch(netresolve_query_t query, int fd, int events)
 {
 	struct netresolve_socket *data = query->user_data;
 	int i;
 
+	if (query->callback != connect_callback)
+		return false;
+
 	debug("socket: dispatching file descriptor: %d %d", fd, events);
 
-	for (i = 0; i < query->response.pathcount; i++) {
-		struct netresolve_path *path = &query->response.paths[i];
+	for (i = 0; i < data->nconnections; i++) {
+		struct netresolve_connection *connection = &data->connections[i];
+
+		if (connection->state == NETRESOLVE_STATE_WAITING && fd == connection->timeout) {
+			debug_query(query, "socket: connection attempt timed out");
+			connect_failed(data, i);
+			return true;
+		}
+
+		if (connection->state == NETRESOLVE_STATE_WAITING && fd == connection->fd) {
+			int error = 0;
+			socklen_t len = sizeof error;
 
-		if (fd == path->socket.fd) {
 			assert(events & POLLOUT);
 
-			socklen_t len = sizeof(errno);
-			getsockopt(path->socket.fd, SOL_SOCKET, SO_ERROR, &errno, &len);
+			getsockopt(connection->fd, SOL_SOCKET, SO_ERROR, &error, &len);
 
-			if (errno)
-				connect_failed(data, path);
+			if (error)
+				connect_failed(data, i);
 			else
-				connect_finished(data, path);
+				connect_finished(data, i);
 
 			return true;
 		}
 	}
 
-	if (fd == data->first_connect_timeout) {
-		for (i = 0; i < query->response.pathcount; i++) {
-			struct netresolve_path *path = &query->response.paths[i];
-
-			switch (path->socket.state) {
-			case NETRESOLVE_STATE_WAITING:
-				netresolve_unwatch_fd(query, path->socket.fd);
-				close(path->socket.fd);
-				/* pass through */
-			case NETRESOLVE_STATE_NONE:
-				path->socket.state = NETRESOLVE_STATE_FAILED;
-				break;
-			default:
-				break;
-			}
-		}
-
+	if (fd == data->delay_timeout) {
+		connect_next(data);
 		connect_check(data);
 		return true;
 	}
@@ -0,0 +1,335 @@
+/* Copyright (c) 2013 Pavel Šimerda, Red Hat, Inc. (psimerda at redhat.com) and others
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <netresolve-private.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Pool of connected sockets
+ *
+ * For each combination of node, service, family, socktype and protocol the
+ * pool keeps up to `size` idle sockets connected using `netresolve_connect()`.
+ * A socket is handed out only when it's still healthy and the resolution it
+ * was connected from hasn't expired. Handing out a socket starts connecting
+ * a replacement, which runs in the event loop of the context.
+ */
+
+struct pool_socket {
+	struct pool_socket *next;
+	int fd;
+	/* Monotonic time in seconds, 0 when the paths carried no TTL */
+	time_t expires;
+};
+
+struct pool_key {
+	struct pool_key *next;
+	char *nodename;
+	char *servname;
+	int family;
+	int socktype;
+	int protocol;
+	struct pool_socket *idle;
+	int nidle;
+	int npending;
+};
+
+/* A replacement being connected. Both its starter and its callback may be
+ * the last to see it, whichever comes later releases it.
+ */
+struct pool_refill {
+	struct pool_refill *previous, *next;
+	struct netresolve_socket_pool *pool;
+	struct pool_key *key;
+	netresolve_query_t query;
+	bool done;
+};
+
+struct netresolve_socket_pool {
+	netresolve_t context;
+	int size;
+	pthread_mutex_t lock;
+	struct pool_key *keys;
+	struct pool_refill refills;
+};
+
+static time_t
+now_sec(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return now.tv_sec;
+}
+
+static bool
+same_string(const char *s1, const char *s2)
+{
+	return s1 && s2 ? !strcmp(s1, s2) : s1 == s2;
+}
+
+static struct pool_key *
+get_key(struct netresolve_socket_pool *pool,
+		const char *nodename, const char *servname,
+		int family, int socktype, int protocol)
+{
+	struct pool_key *key;
+
+	for (key = pool->keys; key; key = key->next)
+		if (same_string(key->nodename, nodename) && same_string(key->servname, servname) &&
+				key->family == family && key->socktype == socktype && key->protocol == protocol)
+			return key;
+
+	if (!(key = calloc(1, sizeof *key)))
+		return NULL;
+	if ((nodename && !(key->nodename = strdup(nodename))) || (servname && !(key->servname = strdup(servname)))) {
+		free(key->nodename);
+		free(key);
+		return NULL;
+	}
+	key->family = family;
+	key->socktype = socktype;
+	key->protocol = protocol;
+	key->next = pool->keys;
+	pool->keys = key;
+
+	return key;
+}
+
+static void
+unlink_refill(struct pool_refill *refill)
+{
+	refill->previous->next = refill->next;
+	refill->next->previous = refill->previous;
+	free(refill);
+}
+
+/* A healthy idle socket has nothing to read, neither data nor end of file. */
+static bool
+is_healthy(int fd)
+{
+	char c;
+
+	return recv(fd, &c, sizeof c, MSG_PEEK | MSG_DONTWAIT) == -1 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+static int
+take_socket(struct pool_key *key)
+{
+	struct pool_socket *item;
+	time_t now = now_sec();
+	int fd = -1;
+
+	while (fd == -1 && (item = key->idle)) {
+		key->idle = item->next;
+		key->nidle--;
+
+		if ((item->expires && now >= item->expires) || !is_healthy(item->fd)) {
+			debug("socket pool: dropping socket %d", item->fd);
+			close(item->fd);
+		} else
+			fd = item->fd;
+
+		free(item);
+	}
+
+	return fd;
+}
+
+static void
+refill_callback(netresolve_query_t query, int idx, int sock, void *user_data)
+{
+	struct pool_refill *refill = user_data;
+	struct netresolve_socket_pool *pool = refill->pool;
+	struct pool_key *key = refill->key;
+	struct pool_socket *item;
+
+	pthread_mutex_lock(&pool->lock);
+
+	key->npending--;
+
+	if (sock != -1) {
+		if ((item = calloc(1, sizeof *item))) {
+			int32_t ttl = 0;
+
+			if (idx >= 0)
+				netresolve_query_get_aux_info(query, idx, NULL, NULL, &ttl);
+			item->fd = sock;
+			item->expires = ttl > 0 ? now_sec() + ttl : 0;
+			item->next = key->idle;
+			key->idle = item;
+			key->nidle++;
+		} else
+			close(sock);
+	}
+
+	if (refill->query)
+		unlink_refill(refill);
+	else
+		refill->done = true;
+
+	pthread_mutex_unlock(&pool->lock);
+}
+
+/* Start connecting replacements for sockets that have been handed out. The
+ * pool lock is not held while starting the queries so that callbacks can
+ * run right away in any thread.
+ */
+static void
+refill(struct netresolve_socket_pool *pool, struct pool_key *key)
+{
+	struct pool_refill *refill;
+	int count;
+
+	pthread_mutex_lock(&pool->lock);
+	count = pool->size - key->nidle - key->npending;
+	key->npending += count > 0 ? count : 0;
+	pthread_mutex_unlock(&pool->lock);
+
+	while (count-- > 0) {
+		netresolve_query_t query;
+
+		pthread_mutex_lock(&pool->lock);
+		if ((refill = calloc(1, sizeof *refill))) {
+			refill->pool = pool;
+			refill->key = key;
+			refill->previous = pool->refills.previous;
+			refill->next = &pool->refills;
+			refill->previous->next = refill->next->previous = refill;
+		}
+		pthread_mutex_unlock(&pool->lock);
+
+		query = refill ? netresolve_connect_start(pool->context, key->nodename, key->servname,
+				key->family, key->socktype, key->protocol, NULL, 0, refill_callback, refill, true) : NULL;
+
+		pthread_mutex_lock(&pool->lock);
+		if (!query) {
+			key->npending--;
+			if (refill)
+				unlink_refill(refill);
+		} else if (refill->done)
+			unlink_refill(refill);
+		else
+			refill->query = query;
+		pthread_mutex_unlock(&pool->lock);
+	}
+}
+
+/* netresolve_socket_pool_new:
+ *
+ * Create a pool keeping up to `size` connected sockets for each node and
+ * service it has been asked for.
+ */
+netresolve_socket_pool_t
+netresolve_socket_pool_new(netresolve_t context, int size)
+{
+	netresolve_socket_pool_t pool;
+	pthread_mutexattr_t attr;
+
+	if (!(pool = calloc(1, sizeof *pool)))
+		return NULL;
+
+	pool->context = context;
+	pool->size = size;
+	pool->refills.previous = pool->refills.next = &pool->refills;
+
+	/* Callbacks run from within `netresolve_connect()` in blocking mode. */
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&pool->lock, &attr);
+	pthread_mutexattr_destroy(&attr);
+
+	return pool;
+}
+
+/* netresolve_socket_pool_free:
+ *
+ * Close all idle sockets and cancel connecting their replacements. The
+ * context must not be dispatched by other threads at the same time.
+ */
+void
+netresolve_socket_pool_free(netresolve_socket_pool_t pool)
+{
+	struct pool_key *key;
+
+	while (pool->refills.next != &pool->refills) {
+		struct pool_refill *refill = pool->refills.next;
+
+		if (refill->query)
+			netresolve_connect_cancel(refill->query);
+		unlink_refill(refill);
+	}
+
+	while ((key = pool->keys)) {
+		struct pool_socket *item;
+
+		pool->keys = key->next;
+		while ((item = key->idle)) {
+			key->idle = item->next;
+			close(item->fd);
+			free(item);
+		}
+		free(key->nodename);
+		free(key->servname);
+		free(key);
+	}
+
+	pthread_mutex_destroy(&pool->lock);
+	free(pool);
+}
+
+/* netresolve_socket_pool_connect:
+ *
+ * Get a connected socket like with `netresolve_connect()`. When the pool
+ * has a healthy socket for the same arguments, the callback is called
+ * right away with `query` set to NULL and `idx` set to -1. Otherwise the
+ * request is passed to `netresolve_connect()`. In both cases the pool starts
+ * connecting sockets for future requests. Returns false when nothing could
+ * be started.
+ */
+bool
+netresolve_socket_pool_connect(netresolve_socket_pool_t pool,
+		const char *nodename, const char *servname,
+		int family, int socktype, int protocol,
+		netresolve_socket_callback_t callback, void *user_data)
+{
+	struct pool_key *key;
+	int sock = -1;
+
+	pthread_mutex_lock(&pool->lock);
+	if ((key = get_key(pool, nodename, servname, family, socktype, protocol)))
+		sock = take_socket(key);
+	pthread_mutex_unlock(&pool->lock);
+
+	if (sock != -1) {
+		debug("socket pool: reusing socket %d", sock);
+		callback(NULL, -1, sock, user_data);
+	} else if (!netresolve_connect(pool->context, nodename, servname, family, socktype, protocol, callback, user_data))
+		return false;
+
+	if (key)
+		refill(pool, key);
+
+	return true;
+}
@@ -0,0 +1,537 @@
+/* Copyright (c) 2013 Pavel Šimerda, Red Hat, Inc. (psimerda at redhat.com) and others
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <netresolve-private.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+/* Destination address selection (RFC 6724)
+ *
+ * Paths are sorted once the query is done. Each IP destination is ranked
+ * using the default policy table and the source address the kernel would
+ * use to reach it. The source address is found by connecting a UDP socket,
+ * which doesn't send anything, and asking for its local address.
+ *
+ * Source addresses are cached per context. A monitor thread listens to
+ * netlink notifications about links, addresses and routes, and bumps
+ * a generation counter that invalidates all caches. Without the monitor,
+ * nothing is cached.
+ *
+ * The same probe tells which address families the host can use to reach
+ * global destinations, which is what `NETRESOLVE_OPTION_ADDRCONFIG` needs.
+ */
+#define SOURCE_ENTRIES 256
+
+struct netresolve_source_cache {
+	unsigned long generation;
+	struct source_entry {
+		bool used;
+		bool usable;
+		int ifindex;
+		struct in6_addr destination;
+		struct in6_addr source;
+	} entries[SOURCE_ENTRIES];
+};
+
+static struct {
+	pthread_mutex_t lock;
+	bool running;
+	bool failed;
+	bool atfork;
+	pthread_t thread;
+	int netlink;
+	int wakeup;
+	unsigned long generation;
+} monitor = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static const struct policy {
+	struct in6_addr prefix;
+	int length;
+	int precedence;
+	int label;
+} policy_table[] = {
+	/* Ordered from the longest prefix, ::/0 terminates the table. */
+	{ IN6ADDR_LOOPBACK_INIT, 128, 50, 0 },
+	{ {{{ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff }}}, 96, 35, 4 },
+	{ IN6ADDR_ANY_INIT, 96, 1, 3 },
+	{ {{{ 0x20, 0x01, 0, 0 }}}, 32, 5, 5 },
+	{ {{{ 0x20, 0x02 }}}, 16, 30, 2 },
+	{ {{{ 0x3f, 0xfe }}}, 16, 1, 12 },
+	{ {{{ 0xfe, 0xc0 }}}, 10, 1, 11 },
+	{ {{{ 0xfc }}}, 7, 3, 13 },
+	{ IN6ADDR_ANY_INIT, 0, 40, 1 },
+};
+
+enum scope {
+	SCOPE_LINK_LOCAL = 0x2,
+	SCOPE_SITE_LOCAL = 0x5,
+	SCOPE_GLOBAL = 0xe,
+};
+
+struct sort_key {
+	bool ip;
+	bool usable;
+	int scope;
+	int label;
+	int precedence;
+	int source_scope;
+	int source_label;
+	int prefixlen;
+};
+
+static int
+common_prefix(const struct in6_addr *a, const struct in6_addr *b, int limit)
+{
+	int bits = 0;
+
+	while (bits < limit && !((a->s6_addr[bits / 8] ^ b->s6_addr[bits / 8]) & (0x80 >> (bits % 8))))
+		bits++;
+
+	return bits;
+}
+
+static const struct policy *
+get_policy(const struct in6_addr *address)
+{
+	const struct policy *policy;
+
+	for (policy = policy_table; policy->length; policy++)
+		if (common_prefix(address, &policy->prefix, policy->length) == policy->length)
+			break;
+
+	return policy;
+}
+
+static int
+get_scope(const struct in6_addr *address)
+{
+	if (IN6_IS_ADDR_MULTICAST(address))
+		return address->s6_addr[1] & 0x0f;
+	if (IN6_IS_ADDR_LOOPBACK(address) || IN6_IS_ADDR_LINKLOCAL(address))
+		return SCOPE_LINK_LOCAL;
+	if (IN6_IS_ADDR_SITELOCAL(address))
+		return SCOPE_SITE_LOCAL;
+	if (IN6_IS_ADDR_V4MAPPED(address)) {
+		const uint8_t *ip4 = address->s6_addr + 12;
+
+		if (ip4[0] == 127 || (ip4[0] == 169 && ip4[1] == 254))
+			return SCOPE_LINK_LOCAL;
+	}
+
+	return SCOPE_GLOBAL;
+}
+
+static void
+to_mapped(struct in6_addr *mapped, int family, const void *address)
+{
+	if (family == AF_INET6) {
+		memcpy(mapped, address, sizeof *mapped);
+		return;
+	}
+
+	memset(mapped, 0, sizeof *mapped);
+	mapped->s6_addr[10] = mapped->s6_addr[11] = 0xff;
+	memcpy(mapped->s6_addr + 12, address, sizeof (struct in_addr));
+}
+
+static void *
+run_monitor(void *arg)
+{
+	struct pollfd fds[] = {
+		{ .fd = monitor.netlink, .events = POLLIN },
+		{ .fd = monitor.wakeup, .events = POLLIN },
+	};
+	char buffer[4096];
+
+	while (poll(fds, 2, -1) != -1 || errno == EINTR) {
+		bool changed = false;
+
+		if (fds[1].revents)
+			break;
+		while (recv(monitor.netlink, buffer, sizeof buffer, MSG_DONTWAIT) > 0 || errno == ENOBUFS)
+			changed = true;
+		if (changed)
+			__atomic_add_fetch(&monitor.generation, 1, __ATOMIC_RELEASE);
+	}
+
+	return NULL;
+}
+
+/* The monitor thread doesn't survive fork(), start a new one on demand.
+ * Changes between the fork and the new monitor would go unnoticed, so drop
+ * the caches filled before.
+ */
+static void
+reset_monitor(void)
+{
+	monitor.generation++;
+	if (monitor.running) {
+		close(monitor.netlink);
+		close(monitor.wakeup);
+		monitor.running = false;
+	}
+	monitor.failed = false;
+	pthread_mutex_init(&monitor.lock, NULL);
+}
+
+static bool
+start_monitor(void)
+{
+	struct sockaddr_nl sa = {
+		.nl_family = AF_NETLINK,
+		.nl_groups = RTMGRP_LINK | RTMGRP_IPV4_IFADDR | RTMGRP_IPV6_IFADDR | RTMGRP_IPV4_ROUTE | RTMGRP_IPV6_ROUTE,
+	};
+	bool running;
+
+	if (__atomic_load_n(&monitor.running, __ATOMIC_ACQUIRE))
+		return true;
+
+	pthread_mutex_lock(&monitor.lock);
+
+	if (!monitor.atfork)
+		monitor.atfork = !pthread_atfork(NULL, NULL, reset_monitor);
+
+	if (!monitor.running && !monitor.failed) {
+		monitor.netlink = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+		monitor.wakeup = eventfd(0, EFD_CLOEXEC);
+
+		if (monitor.netlink != -1 && monitor.wakeup != -1 &&
+				bind(monitor.netlink, (struct sockaddr *) &sa, sizeof sa) == 0 &&
+				pthread_create(&monitor.thread, NULL, run_monitor, NULL) == 0) {
+			__atomic_store_n(&monitor.running, true, __ATOMIC_RELEASE);
+		} else {
+			if (monitor.netlink != -1)
+				close(monitor.netlink);
+			if (monitor.wakeup != -1)
+				close(monitor.wakeup);
+			monitor.failed = true;
+			debug("sort: cannot monitor network configuration, source addresses won't be cached");
+		}
+	}
+	running = monitor.running;
+
+	pthread_mutex_unlock(&monitor.lock);
+
+	return running;
+}
+
+static void __attribute__((destructor))
+stop_monitor(void)
+{
+	uint64_t value = 1;
+
+	if (!monitor.running)
+		return;
+
+	if (write(monitor.wakeup, &value, sizeof value) == sizeof value)
+		pthread_join(monitor.thread, NULL);
+	close(monitor.netlink);
+	close(monitor.wakeup);
+	monitor.running = false;
+}
+
+static struct source_entry *
+get_cached_source(netresolve_t context, const struct in6_addr *destination, int ifindex, unsigned long generation)
+{
+	struct netresolve_source_cache *cache = context->sources;
+	struct source_entry *entry;
+	uint32_t hash = 2166136261u;
+	int i;
+
+	if (!cache && !(cache = context->sources = calloc(1, sizeof *cache)))
+		return NULL;
+
+	if (cache->generation != generation) {
+		memset(cache->entries, 0, sizeof cache->entries);
+		cache->generation = generation;
+	}
+
+	for (i = 0; i < sizeof *destination; i++)
+		hash = (hash ^ destination->s6_addr[i]) * 16777619u;
+	entry = &cache->entries[(hash ^ ifindex) % SOURCE_ENTRIES];
+
+	if (!entry->used || entry->ifindex != ifindex || memcmp(&entry->destination, destination, sizeof *destination)) {
+		memset(entry, 0, sizeof *entry);
+		entry->ifindex = ifindex;
+		entry->destination = *destination;
+	}
+
+	return entry;
+}
+
+/* Find the source address used to reach a destination, returns false when
+ * the destination is unreachable.
+ */
+static bool
+probe_source(int family, const void *address, int ifindex, struct in6_addr *source)
+{
+	union {
+		struct sockaddr sa;
+		struct sockaddr_in sin;
+		struct sockaddr_in6 sin6;
+	} sa = { .sa = { .sa_family = family } };
+	socklen_t salen;
+	int sock;
+	bool usable = false;
+
+	if (family == AF_INET) {
+		sa.sin.sin_port = htons(9);
+		memcpy(&sa.sin.sin_addr, address, sizeof sa.sin.sin_addr);
+		salen = sizeof sa.sin;
+	} else {
+		sa.sin6.sin6_port = htons(9);
+		sa.sin6.sin6_scope_id = ifindex;
+		memcpy(&sa.sin6.sin6_addr, address, sizeof sa.sin6.sin6_addr);
+		salen = sizeof sa.sin6;
+	}
+
+	if ((sock = socket(family, SOCK_DGRAM | SOCK_CLOEXEC, 0)) == -1)
+		return false;
+
+	if (connect(sock, &sa.sa, salen) == 0 && getsockname(sock, &sa.sa, &salen) == 0) {
+		to_mapped(source, family, family == AF_INET ? (void *) &sa.sin.sin_addr : (void *) &sa.sin6.sin6_addr);
+		usable = true;
+	}
+
+	close(sock);
+
+	return usable;
+}
+
+static void
+get_source(netresolve_t context, int family, const void *address, const struct in6_addr *destination,
+		int ifindex, bool *usable, struct in6_addr *source)
+{
+	struct source_entry *entry;
+	unsigned long generation;
+
+	if (!start_monitor()) {
+		*usable = probe_source(family, address, ifindex, source);
+		return;
+	}
+
+	generation = __atomic_load_n(&monitor.generation, __ATOMIC_ACQUIRE);
+
+	netresolve_context_lock(context);
+	entry = get_cached_source(context, destination, ifindex, generation);
+	if (entry && entry->used) {
+		*usable = entry->usable;
+		*source = entry->source;
+		netresolve_context_unlock(context);
+		return;
+	}
+	netresolve_context_unlock(context);
+
+	*usable = probe_source(family, address, ifindex, source);
+
+	netresolve_context_lock(context);
+	entry = get_cached_source(context, destination, ifindex, generation);
+	if (entry && context->sources->generation == generation) {
+		entry->used = true;
+		entry->usable = *usable;
+		entry->source = *source;
+	}
+	netresolve_context_unlock(context);
+}
+
+static void
+get_sort_key(netresolve_t context, const struct netresolve_path *path, struct sort_key *key)
+{
+	const struct policy *policy;
+	struct in6_addr destination;
+	struct in6_addr source;
+	int family = path->node.family;
+
+	memset(key, 0, sizeof *key);
+
+	if (family != AF_INET && family != AF_INET6)
+		return;
+
+	to_mapped(&destination, family, path->node.address);
+	key->ip = true;
+
+	/* Unspecified addresses are used for binding, they stand for any global
+	 * address of their family and there's nothing to probe.
+	 */
+	if (family == AF_INET ? !path->node.address4.s_addr : IN6_IS_ADDR_UNSPECIFIED(&path->node.address6)) {
+		policy = family == AF_INET ? get_policy(&destination) : &policy_table[sizeof policy_table / sizeof *policy_table - 1];
+		key->usable = true;
+		key->scope = key->source_scope = SCOPE_GLOBAL;
+		key->label = key->source_label = policy->label;
+		key->precedence = policy->precedence;
+		return;
+	}
+
+	get_source(context, family, path->node.address, &destination, path->node.ifindex, &key->usable, &source);
+
+	policy = get_policy(&destination);
+	key->scope = get_scope(&destination);
+	key->label = policy->label;
+	key->precedence = policy->precedence;
+	if (key->usable) {
+		key->source_scope = get_scope(&source);
+		key->source_label = get_policy(&source)->label;
+		if (family == AF_INET6)
+			key->prefixlen = common_prefix(&destination, &source, 64);
+	}
+}
+
+/* Compare paths according to the destination address selection rules, the
+ * rules about deprecated, home and native addresses are not implemented.
+ */
+static int
+key_cmp(const struct sort_key *k1, const struct sort_key *k2)
+{
+	if (!k1->ip || !k2->ip)
+		return 0;
+
+	/* Rule 1: Avoid unusable destinations. */
+	if (k1->usable != k2->usable)
+		return k1->usable ? -1 : 1;
+	/* Rule 2: Prefer matching scope. */
+	if ((k1->scope == k1->source_scope) != (k2->scope == k2->source_scope))
+		return k1->scope == k1->source_scope ? -1 : 1;
+	/* Rule 5: Prefer matching label. */
+	if ((k1->label == k1->source_label) != (k2->label == k2->source_label))
+		return k1->label == k1->source_label ? -1 : 1;
+	/* Rule 6: Prefer higher precedence. */
+	if (k1->precedence != k2->precedence)
+		return k1->precedence > k2->precedence ? -1 : 1;
+	/* Rule 8: Prefer smaller scope. */
+	if (k1->scope != k2->scope)
+		return k1->scope < k2->scope ? -1 : 1;
+	/* Rule 9: Use longest matching prefix. */
+	if (k1->prefixlen != k2->prefixlen)
+		return k1->prefixlen > k2->prefixlen ? -1 : 1;
+	/* Rule 10: Otherwise, leave the order unchanged. */
+	return 0;
+}
+
+struct sort_item {
+	struct sort_key key;
+	struct netresolve_path path;
+};
+
+static void
+merge_sort(struct sort_item *items, struct sort_item *tmp, size_t count)
+{
+	size_t half = count / 2;
+	size_t i, j, k;
+
+	if (count < 2)
+		return;
+
+	merge_sort(items, tmp, half);
+	merge_sort(items + half, tmp, count - half);
+
+	memcpy(tmp, items, half * sizeof *items);
+	for (i = 0, j = half, k = 0; i < half; k++)
+		items[k] = j < count && key_cmp(&items[j].key, &tmp[i].key) < 0 ? items[j++] : tmp[i++];
+}
+
+/* netresolve_sort_paths:
+ *
+ * Paths are stored in the order they were added and sorted once when the
+ * query is done. The sort is stable so that the order of equally ranked
+ * paths is kept as the backends provided them.
+ */
+void
+netresolve_sort_paths(netresolve_query_t query)
+{
+	struct netresolve_response *response = &query->response;
+	struct sort_item *items;
+	size_t count = response->pathcount;
+	size_t i;
+
+	if (count < 2)
+		return;
+	if (!(items = malloc((count + count / 2) * sizeof *items)))
+		return;
+
+	for (i = 0; i < count; i++) {
+		items[i].path = response->paths[i];
+		get_sort_key(query->context, &items[i].path, &items[i].key);
+	}
+
+	merge_sort(items, items + count, count);
+
+	for (i = 0; i < count; i++)
+		response->paths[i] = items[i].path;
+	free(response->sockaddrs);
+	response->sockaddrs = NULL;
+
+	free(items);
+}
+
+static bool
+has_global_source(netresolve_t context, int family, const void *address)
+{
+	struct in6_addr destination;
+	struct in6_addr source;
+	bool usable;
+
+	to_mapped(&destination, family, address);
+	get_source(context, family, address, &destination, 0, &usable, &source);
+
+	return usable && get_scope(&source) > SCOPE_LINK_LOCAL;
+}
+
+/* netresolve_sort_addrconfig:
+ *
+ * Returns the only address family that has a route and a non-loopback,
+ * non-link-local source address for global destinations, or AF_UNSPEC when
+ * both or neither of IPv4 and IPv6 have one.
+ */
+int
+netresolve_sort_addrconfig(netresolve_t context)
+{
+	/* Documentation prefixes, reached through the default route */
+	static const uint8_t inet[4] = { 192, 0, 2, 1 };
+	static const uint8_t inet6[16] = { 0x20, 0x01, 0x0d, 0xb8, [15] = 1 };
+	bool has_inet = has_global_source(context, AF_INET, inet);
+	bool has_inet6 = has_global_source(context, AF_INET6, inet6);
+
+	if (has_inet && !has_inet6)
+		return AF_INET;
+	if (has_inet6 && !has_inet)
+		return AF_INET6;
+
+	return AF_UNSPEC;
+}
+
+/* netresolve_sort_clear:
+ *
+ * Drop the source address cache of a context.
+ */
+void
+netresolve_sort_clear(netresolve_t context)
+{
+	free(context->sources);
+	context->sources = NULL;
+}
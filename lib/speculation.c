@@ -0,0 +1,201 @@
+/* Copyright (c) 2013 Pavel Šimerda, Red Hat, Inc. (psimerda at redhat.com) and others
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <netresolve-private.h>
+
+/* In speculative mode, the backends of the chain are started at once, each
+ * of them in a child query with the same request. The results are then
+ * committed in the order of the chain exactly as if the backends were run
+ * one after another, i.e. a successful backend is only followed by the
+ * next mandatory one while a failed backend is followed by the next one.
+ * Children of backends that are skipped this way are cancelled.
+ */
+
+static netresolve_query_t
+new_child(netresolve_query_t query, struct netresolve_backend **backend)
+{
+	struct netresolve_request *request;
+	netresolve_query_t child;
+
+	if (!(child = netresolve_query_new(query->context, query->request.type)))
+		return NULL;
+
+	request = &child->request;
+	memcpy(request, &query->request, sizeof *request);
+	request->nodename = request->nodename ? strdup(request->nodename) : NULL;
+	request->servname = request->servname ? strdup(request->servname) : NULL;
+	request->dns_name = request->dns_name ? strdup(request->dns_name) : NULL;
+
+	/* The chain of the context may have been replaced in the meantime. */
+	netresolve_chain_unref(child->chain);
+	child->chain = netresolve_chain_ref(query->chain);
+	child->parent = query;
+	child->backend = backend;
+
+	return child;
+}
+
+static void
+free_child(netresolve_query_t query, int i)
+{
+	netresolve_query_t child = query->speculation.children[i];
+
+	if (!child)
+		return;
+
+	query->speculation.children[i] = NULL;
+	child->parent = NULL;
+	netresolve_query_free(child);
+}
+
+static void
+commit(netresolve_query_t query)
+{
+	struct netresolve_speculation *speculation = &query->speculation;
+	enum netresolve_state state = NETRESOLVE_STATE_FAILED;
+	netresolve_query_t child;
+	int i;
+
+	if (speculation->starting)
+		return;
+
+	while (speculation->cursor < speculation->count) {
+		child = speculation->children[speculation->cursor];
+		i = speculation->cursor;
+
+		if (child) {
+			if (child->state != NETRESOLVE_STATE_DONE && child->state != NETRESOLVE_STATE_FAILED)
+				return;
+			state = child->state;
+			netresolve_backend_merge_response(query, child);
+			free_child(query, i);
+		} else
+			state = NETRESOLVE_STATE_FAILED;
+
+		debug_query(query, "committed backend %d: %s", i, netresolve_query_state_to_string(state));
+
+		/* Only mandatory backends follow a successful one. */
+		speculation->cursor++;
+		if (state == NETRESOLVE_STATE_DONE) {
+			while (speculation->cursor < speculation->count && !query->backend[speculation->cursor]->mandatory)
+				free_child(query, speculation->cursor++);
+		}
+	}
+
+	/* Make sure the chain is not run again. */
+	query->backend += speculation->count - 1;
+
+	if (state == NETRESOLVE_STATE_DONE)
+		netresolve_query_set_state(query, NETRESOLVE_STATE_RESOLVED);
+	netresolve_query_set_state(query, state);
+}
+
+/* netresolve_speculation_start:
+ *
+ * Start all backends of the chain in parallel. Returns `false` when the
+ * query is to be set up the usual way.
+ */
+bool
+netresolve_speculation_start(netresolve_query_t query)
+{
+	struct netresolve_speculation *speculation = &query->speculation;
+	int count;
+	int i;
+
+	if (!query->context->config.speculative || query->parent || speculation->children)
+		return false;
+	/* Children would have to lock their parent. */
+	if (query->context->threaded)
+		return false;
+	/* Setup without a timeout must finish immediately. */
+	if (!query->request.timeout)
+		return false;
+
+	for (count = 0; query->backend[count]; count++)
+		;
+	if (count < 2)
+		return false;
+
+	if (!(speculation->children = calloc(count, sizeof *speculation->children)))
+		return false;
+	speculation->count = count;
+	speculation->cursor = 0;
+
+	for (i = 0; i < count; i++) {
+		if (!(speculation->children[i] = new_child(query, query->backend + i))) {
+			netresolve_speculation_cancel(query);
+			return false;
+		}
+	}
+
+	debug_query(query, "starting %d backends speculatively", count);
+
+	netresolve_query_set_state(query, NETRESOLVE_STATE_WAITING);
+
+	/* Children failing immediately are committed once all of them run. */
+	speculation->starting = true;
+	for (i = 0; i < count; i++)
+		if (speculation->children[i])
+			netresolve_query_set_state(speculation->children[i], NETRESOLVE_STATE_SETUP);
+	speculation->starting = false;
+
+	commit(query);
+
+	return true;
+}
+
+/* netresolve_speculation_notify:
+ *
+ * Called when a child query is finished.
+ */
+void
+netresolve_speculation_notify(netresolve_query_t child)
+{
+	commit(child->parent);
+}
+
+/* netresolve_speculation_cancel:
+ *
+ * Cancel all children of the query. It's also used to detach a child query
+ * that is freed by other means.
+ */
+void
+netresolve_speculation_cancel(netresolve_query_t query)
+{
+	struct netresolve_speculation *speculation = &query->speculation;
+	int i;
+
+	if (query->parent) {
+		speculation = &query->parent->speculation;
+		for (i = 0; i < speculation->count; i++)
+			if (speculation->children[i] == query)
+				speculation->children[i] = NULL;
+		query->parent = NULL;
+		return;
+	}
+
+	for (i = 0; i < speculation->count; i++)
+		free_child(query, i);
+	free(speculation->children);
+	memset(speculation, 0, sizeof *speculation);
+}
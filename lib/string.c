@@ -160,8 +160,13 @@ netresolve_get_request_string(netresolve_query_t query)
 {
 	const char *node = netresolve_backend_get_nodename(query);
 	const char *service = netresolve_backend_get_servname(query);
-	char *start = query->buffer;
-	char *end = query->buffer + sizeof query->buffer;
+	struct netresolve_query_extra *extra = netresolve_query_get_extra(query);
+	char *start, *end;
+
+	if (!extra)
+		return NULL;
+	start = extra->buffer;
+	end = extra->buffer + sizeof extra->buffer;
 
 	bprintf(&start, end, "request %s %s\n", PACKAGE_NAME, VERSION);
 	if (node)
@@ -170,25 +175,30 @@ netresolve_get_request_string(netresolve_query_t query)
 		bprintf(&start, end, "service %s\n", service);
 	bprintf(&start, end, "\n");
 
-	return query->buffer;
+	return extra->buffer;
 }
 
 const char *
 netresolve_get_path_string(netresolve_query_t query, int i)
 {
-	char *start = query->buffer;
-	char *end = query->buffer + sizeof query->buffer;
+	struct netresolve_query_extra *extra = netresolve_query_get_extra(query);
+	char *start, *end;
+
+	if (!extra)
+		return NULL;
+	start = extra->buffer;
+	end = extra->buffer + sizeof extra->buffer;
 
 	add_path(&start, end, query, i);
 
-	return query->buffer;
+	return extra->buffer;
 }
 
 const char *
 netresolve_get_response_string(netresolve_query_t query)
 {
-	char *start = query->buffer;
-	char *end = query->buffer + sizeof query->buffer;
+	struct netresolve_query_extra *extra = netresolve_query_get_extra(query);
+	char *start, *end;
 
 	const char *nodename = netresolve_query_get_node_name(query);
 	const char *servname = netresolve_query_get_service_name(query);
@@ -198,6 +208,11 @@ netresolve_get_response_string(netresolve_query_t query)
 	const uint8_t *answer = netresolve_query_get_dns_answer(query, &length);
 	bool secure = netresolve_query_get_secure(query);
 
+	if (!extra)
+		return NULL;
+	start = extra->buffer;
+	end = extra->buffer + sizeof extra->buffer;
+
 	bprintf(&start, end, "response %s %s\n", PACKAGE_NAME, VERSION);
 	if (nodename)
 		bprintf(&start, end, "name %s\n", nodename);
@@ -227,5 +242,5 @@ netresolve_get_response_string(netresolve_query_t query)
 		bprintf(&start, end, "secure\n");
 	bprintf(&start, end, "\n");
 
-	return query->buffer;
+	return extra->buffer;
 }
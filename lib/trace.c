@@ -0,0 +1,201 @@
+/* Copyright (c) 2013 Pavel Šimerda, Red Hat, Inc. (psimerda at redhat.com) and others
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <netresolve-private.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+/* Binary trace of query events
+ *
+ * Every thread records into its own ring, so recording needs neither locks
+ * nor formatting. The fields are stored atomically to let another thread
+ * dump the rings at any time. An entry overwritten while being dumped may
+ * appear mixed up, which is acceptable for a diagnostic tool.
+ */
+
+#define TRACE_ENTRIES 1024
+
+struct trace_entry {
+	uint64_t timestamp;
+	const void *query;
+	int event;
+	int value;
+};
+
+struct trace_ring {
+	struct trace_ring *next;
+	pid_t tid;
+	bool used;
+	uint64_t head;
+	struct trace_entry entries[TRACE_ENTRIES];
+};
+
+bool netresolve_trace_enabled = false;
+
+static struct {
+	pthread_mutex_t lock;
+	pthread_once_t once;
+	pthread_key_t key;
+	struct trace_ring *rings;
+} trace = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.once = PTHREAD_ONCE_INIT,
+};
+
+static void
+release_ring(void *data)
+{
+	struct trace_ring *ring = data;
+
+	pthread_mutex_lock(&trace.lock);
+	ring->used = false;
+	pthread_mutex_unlock(&trace.lock);
+}
+
+static void
+create_key(void)
+{
+	pthread_key_create(&trace.key, release_ring);
+}
+
+/* Rings of exited threads are handed over to new threads. They are never
+ * freed so that a late dump or a thread exiting during process exit never
+ * touches freed memory.
+ */
+static struct trace_ring *
+get_ring(void)
+{
+	struct trace_ring *ring;
+
+	pthread_once(&trace.once, create_key);
+
+	if ((ring = pthread_getspecific(trace.key)))
+		return ring;
+
+	pthread_mutex_lock(&trace.lock);
+	for (ring = trace.rings; ring; ring = ring->next)
+		if (!ring->used)
+			break;
+	if (!ring && (ring = calloc(1, sizeof *ring))) {
+		ring->next = trace.rings;
+		trace.rings = ring;
+	}
+	if (ring) {
+		ring->used = true;
+		ring->tid = syscall(SYS_gettid);
+		__atomic_store_n(&ring->head, 0, __ATOMIC_RELAXED);
+	}
+	pthread_mutex_unlock(&trace.lock);
+
+	if (ring)
+		pthread_setspecific(trace.key, ring);
+
+	return ring;
+}
+
+/* netresolve_trace_record:
+ *
+ * Record a query event into the ring of the calling thread. Use the
+ * `netresolve_trace()` macro that checks whether tracing is enabled.
+ */
+void
+netresolve_trace_record(netresolve_query_t query, enum netresolve_trace_event event, int value)
+{
+	struct trace_ring *ring = get_ring();
+	struct trace_entry *entry;
+	struct timespec now;
+	uint64_t head;
+
+	if (!ring)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+	entry = &ring->entries[head % TRACE_ENTRIES];
+	__atomic_store_n(&entry->timestamp, now.tv_sec * 1000000000ull + now.tv_nsec, __ATOMIC_RELAXED);
+	__atomic_store_n(&entry->query, query, __ATOMIC_RELAXED);
+	__atomic_store_n(&entry->event, event, __ATOMIC_RELAXED);
+	__atomic_store_n(&entry->value, value, __ATOMIC_RELAXED);
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+void
+netresolve_set_trace(bool enabled)
+{
+	netresolve_trace_enabled = enabled;
+}
+
+static void
+dump_entry(int fd, pid_t tid, const struct trace_entry *entry)
+{
+	uint64_t timestamp = __atomic_load_n(&entry->timestamp, __ATOMIC_RELAXED);
+	const void *query = __atomic_load_n(&entry->query, __ATOMIC_RELAXED);
+	int event = __atomic_load_n(&entry->event, __ATOMIC_RELAXED);
+	int value = __atomic_load_n(&entry->value, __ATOMIC_RELAXED);
+
+	dprintf(fd, "%llu.%09llu [thread %d] [query %p] ",
+			(unsigned long long) timestamp / 1000000000,
+			(unsigned long long) timestamp % 1000000000,
+			tid, query);
+
+	switch (event) {
+	case NETRESOLVE_TRACE_STATE:
+		dprintf(fd, "state %s\n", netresolve_query_state_to_string(value));
+		break;
+	case NETRESOLVE_TRACE_WATCH:
+		dprintf(fd, "watch fd %d\n", value);
+		break;
+	case NETRESOLVE_TRACE_UNWATCH:
+		dprintf(fd, "unwatch fd %d\n", value);
+		break;
+	case NETRESOLVE_TRACE_DISPATCH:
+		dprintf(fd, "dispatch fd %d\n", value);
+		break;
+	default:
+		dprintf(fd, "event %d %d\n", event, value);
+	}
+}
+
+/* netresolve_trace_dump:
+ *
+ * Write the recorded events of all threads in a human readable form to
+ * `fd`. Events of each thread are listed from the oldest to the newest.
+ */
+void
+netresolve_trace_dump(int fd)
+{
+	struct trace_ring *ring;
+
+	pthread_mutex_lock(&trace.lock);
+	for (ring = trace.rings; ring; ring = ring->next) {
+		uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+		uint64_t i = head > TRACE_ENTRIES ? head - TRACE_ENTRIES : 0;
+
+		for (; i < head; i++)
+			dump_entry(fd, ring->tid, &ring->entries[i % TRACE_ENTRIES]);
+	}
+	pthread_mutex_unlock(&trace.lock);
+}
@@ -0,0 +1,337 @@
+/* Copyright (c) 2013 Pavel Šimerda, Red Hat, Inc. (psimerda at redhat.com) and others
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <netresolve-uring.h>
+#include <netresolve-nonblock.h>
+#include <netresolve-private.h>
+#include <liburing.h>
+#include <unistd.h>
+#include <string.h>
+#include <assert.h>
+
+#define URING_ENTRIES 64
+
+/* The io_uring based loop uses oneshot poll requests that are re-armed after
+ * each event. Multishot poll requests would spare the re-arm SQE but they only
+ * report new wakeups, while netresolve backends expect level-triggered
+ * behavior and don't always drain their file descriptors.
+ *
+ * Re-arm requests produced while dispatching are only queued and get
+ * submitted together with the next wait, so that a whole dispatch cycle
+ * costs a single `io_uring_enter()`.
+ */
+struct netresolve_uring {
+	struct io_uring ring;
+	int count;
+	int inflight;
+	bool dispatching;
+};
+
+struct netresolve_uring_source {
+	netresolve_source_t source;
+	int fd;
+	int events;
+	bool armed;
+	bool busy;
+	bool removed;
+};
+
+static struct io_uring_sqe *
+get_sqe(struct netresolve_uring *loop)
+{
+	struct io_uring_sqe *sqe;
+
+	/* Flush the submission queue when it is full. */
+	while (!(sqe = io_uring_get_sqe(&loop->ring))) {
+		int status = io_uring_submit(&loop->ring);
+
+		if (status < 0) {
+			error("io_uring_submit: %s", strerror(-status));
+			abort();
+		}
+	}
+
+	return sqe;
+}
+
+static void
+submit(struct netresolve_uring *loop)
+{
+	int status;
+
+	if (loop->dispatching || !io_uring_sq_ready(&loop->ring))
+		return;
+
+	if ((status = io_uring_submit(&loop->ring)) < 0) {
+		error("io_uring_submit: %s", strerror(-status));
+		abort();
+	}
+}
+
+static void
+arm(struct netresolve_uring *loop, struct netresolve_uring_source *handle)
+{
+	struct io_uring_sqe *sqe = get_sqe(loop);
+
+	io_uring_prep_poll_add(sqe, handle->fd, handle->events);
+	io_uring_sqe_set_data(sqe, handle);
+
+	handle->armed = true;
+	loop->inflight++;
+}
+
+static void *
+watch_fd(netresolve_t context, int fd, int events, netresolve_source_t source)
+{
+	struct netresolve_uring *loop = netresolve_get_user_data(context);
+	struct netresolve_uring_source *handle;
+
+	if (!(handle = calloc(1, sizeof *handle)))
+		abort();
+
+	handle->source = source;
+	handle->fd = fd;
+	handle->events = events;
+
+	arm(loop, handle);
+	submit(loop);
+
+	loop->count++;
+
+	return handle;
+}
+
+static void
+unwatch_fd(netresolve_t context, int fd, void *data)
+{
+	struct netresolve_uring *loop = netresolve_get_user_data(context);
+	struct netresolve_uring_source *handle = data;
+
+	assert(handle && handle->fd == fd && !handle->removed);
+
+	handle->removed = true;
+	loop->count--;
+
+	if (handle->armed) {
+		/* The handle is freed when the cancelled poll request completes. */
+		struct io_uring_sqe *sqe = get_sqe(loop);
+
+		io_uring_prep_poll_remove(sqe, (uintptr_t) handle);
+		io_uring_sqe_set_data(sqe, NULL);
+		submit(loop);
+	} else if (!handle->busy)
+		free(handle);
+}
+
+static int
+reap_events(netresolve_t context)
+{
+	struct netresolve_uring *loop = netresolve_get_user_data(context);
+	struct io_uring_cqe *cqe;
+	int nevents = 0;
+
+	while (io_uring_peek_cqe(&loop->ring, &cqe) == 0) {
+		struct netresolve_uring_source *handle = io_uring_cqe_get_data(cqe);
+		int res = cqe->res;
+		int events;
+
+		io_uring_cqe_seen(&loop->ring, cqe);
+
+		/* Completion of a poll removal request. */
+		if (!handle)
+			continue;
+
+		handle->armed = false;
+		loop->inflight--;
+
+		if (handle->removed) {
+			free(handle);
+			continue;
+		}
+		if (res < 0) {
+			error("io_uring poll: %s", strerror(-res));
+			abort();
+		}
+
+		/* Hangups and errors are reported as the requested events so that
+		 * the backend picks them up with its next read or write.
+		 */
+		events = res & handle->events;
+		if (!events)
+			events = handle->events;
+
+		handle->busy = true;
+		if (!netresolve_dispatch(context, handle->source, events))
+			abort();
+		handle->busy = false;
+
+		if (handle->removed)
+			free(handle);
+		else
+			arm(loop, handle);
+
+		nevents++;
+	}
+
+	return nevents;
+}
+
+static int
+dispatch_events(netresolve_t context)
+{
+	struct netresolve_uring *loop = netresolve_get_user_data(context);
+	int status;
+	int nevents;
+
+	status = io_uring_submit_and_wait(&loop->ring, 1);
+	if (status < 0 && status != -EINTR) {
+		error("io_uring_enter: %s", strerror(-status));
+		abort();
+	}
+
+	loop->dispatching = true;
+	nevents = reap_events(context);
+	loop->dispatching = false;
+
+	return nevents;
+}
+
+static void
+free_user_data(void *user_data)
+{
+	struct netresolve_uring *loop = user_data;
+
+	assert(!loop->count);
+
+	/* Collect cancelled poll requests so that their handles get freed. */
+	while (loop->inflight > 0) {
+		struct io_uring_cqe *cqe;
+		struct netresolve_uring_source *handle;
+
+		if (io_uring_submit_and_wait(&loop->ring, 1) < 0)
+			break;
+		while (io_uring_peek_cqe(&loop->ring, &cqe) == 0) {
+			if ((handle = io_uring_cqe_get_data(cqe))) {
+				assert(handle->removed);
+				loop->inflight--;
+				free(handle);
+			}
+			io_uring_cqe_seen(&loop->ring, cqe);
+		}
+	}
+
+	io_uring_queue_exit(&loop->ring);
+	free(loop);
+}
+
+/* netresolve_uring_new:
+ *
+ * Use this constructor instead of `netresolve_context_new()` to use the
+ * library in a nonblocking mode driven by an io_uring instance. Use
+ * `netresolve_uring_fd()` to retrieve the ring file descriptor and
+ * `netresolve_context_free()` to dispose of the context.
+ */
+netresolve_t
+netresolve_uring_new(void)
+{
+	netresolve_t context = netresolve_context_new();
+
+	if (context) {
+		if (netresolve_uring_fd(context) == -1) {
+			netresolve_context_free(context);
+			context = NULL;
+		}
+	}
+
+	return context;
+}
+
+/* netresolve_uring_fd:
+ *
+ * Retrieve the io_uring file descriptor from the context. Poll it for
+ * reading in your event loop and call `netresolve_uring_dispatch()` when
+ * it becomes readable.
+ *
+ * Like `netresolve_epoll_fd()`, this function can be used to convert
+ * a context created by `netresolve_context_new()` before the first query.
+ */
+int
+netresolve_uring_fd(netresolve_t context)
+{
+	struct netresolve_uring *loop = netresolve_get_user_data(context);
+	int status;
+
+	if (!loop) {
+		if (!(loop = calloc(1, sizeof *loop)))
+			return -1;
+		if ((status = io_uring_queue_init(URING_ENTRIES, &loop->ring, 0)) < 0) {
+			error("io_uring_queue_init: %s", strerror(-status));
+			free(loop);
+			return -1;
+		}
+
+		netresolve_set_fd_callbacks(context, watch_fd, unwatch_fd, loop, free_user_data);
+
+		debug("created io_uring file descriptor: %d", loop->ring.ring_fd);
+	}
+
+	return loop->ring.ring_fd;
+}
+
+/* netresolve_uring_dispatch:
+ *
+ * Call this function when the file descriptor is ready for reading. All
+ * pending completions are processed and all requests they produce are
+ * submitted with a single `io_uring_enter()` before the function returns.
+ */
+void
+netresolve_uring_dispatch(netresolve_t context)
+{
+	struct netresolve_uring *loop = netresolve_get_user_data(context);
+
+	/* Completions are read from the shared ring without entering the
+	 * kernel. Re-armed poll requests that complete right away make the
+	 * ring file descriptor readable again.
+	 */
+	loop->dispatching = true;
+	reap_events(context);
+	loop->dispatching = false;
+
+	submit(loop);
+}
+
+/* netresolve_uring_wait:
+ *
+ * Run an io_uring based main loop for the context until all pending
+ * queries are fully processed. See `netresolve_epoll_wait()`.
+ */
+void
+netresolve_uring_wait(netresolve_t context)
+{
+	struct netresolve_uring *loop = netresolve_get_user_data(context);
+
+	while (loop->count > 0)
+		dispatch_events(context);
+
+	submit(loop);
+}
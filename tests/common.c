@@ -17,6 +17,26 @@ check_address(netresolve_query_t query, int exp_family, const char *exp_address_
 	assert(family = exp_family);
 	assert(!memcmp(address, exp_address, family == AF_INET6 ? 16 : 4));
 	assert(ifindex == exp_ifindex);
+
+	/* The same path through the bulk accessor */
+	size_t count;
+	const struct netresolve_sockaddr *sockaddrs = netresolve_query_get_sockaddrs(query, &count);
+
+	assert(count == 1);
+	assert(sockaddrs[0].sa.ss_family == exp_family);
+	if (exp_family == AF_INET6) {
+		const struct sockaddr_in6 *sin6 = (const void *) &sockaddrs[0].sa;
+
+		assert(sockaddrs[0].salen == sizeof *sin6);
+		assert(!memcmp(&sin6->sin6_addr, exp_address, 16));
+		assert(sin6->sin6_scope_id == exp_ifindex);
+	} else {
+		const struct sockaddr_in *sin = (const void *) &sockaddrs[0].sa;
+
+		assert(sockaddrs[0].salen == sizeof *sin);
+		assert(!memcmp(&sin->sin_addr, exp_address, 4));
+	}
+	assert(netresolve_query_get_sockaddr(query, 0, NULL, NULL, NULL, NULL) == (const void *) &sockaddrs[0].sa);
 }
 
 void
@@ -26,7 +46,7 @@ callback1(netresolve_query_t query, void *user_data)
 
 	check_address(query, AF_INET6, "1:2:3:4:5:6:7:8", 999999);
 
-	priv->finished++;
+	__sync_fetch_and_add(&priv->finished, 1);
 }
 
 void
@@ -36,5 +56,5 @@ callback2(netresolve_query_t query, void *user_data)
 
 	check_address(query, AF_INET, "1.2.3.4", 999999);
 
-	priv->finished++;
+	__sync_fetch_and_add(&priv->finished, 1);
 }
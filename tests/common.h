@@ -22,6 +22,7 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 #include <netresolve.h>
+#include <netresolve-compat.h>
 #include <arpa/inet.h>
 #include <assert.h>
 #include <errno.h>
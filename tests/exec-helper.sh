@@ -0,0 +1,51 @@
+#!/bin/sh
+# Exec backend helper used by the tests. Each response
+# repeats the request id and carries a batch of paths with the port taken
+# from the first label of the node name. Node `unix` is answered with two
+# AF_UNIX sockets, node `gap[.port]` with one path right away and another
+# one two seconds later, node `history.port` with 127.0.0.2 on the next port
+# followed by 127.0.0.1 on the given one, node `sort` with a fixed set of
+# addresses in an order that destination address selection has to change.
+# Node `exit` makes the helper exit in the middle of the response, which
+# only the persistent protocol survives.
+
+while read -r key value; do
+	case "$key" in
+	id)
+		id="$value"
+		;;
+	node)
+		port="${value%%.*}"
+		case "$value" in
+		*.*) target="${value#*.}" ;;
+		*) target=1 ;;
+		esac
+		;;
+	"")
+		echo "id $id"
+		if [ "$port" = unix ]; then
+			echo "unix /run/first.sock"
+			echo "unix /run/second.sock"
+		elif [ "$port" = exit ]; then
+			echo "path 127.0.0.1 stream tcp 1"
+			exit
+		elif [ "$port" = sort ]; then
+			for address in 255.255.255.255 2002:c000:201::1 fd00::1 127.0.0.3 192.0.2.1 127.0.0.2 ::1 127.0.0.4; do
+				echo "path $address stream tcp 80"
+			done
+		elif [ "$port" = gap ]; then
+			echo "path 127.0.0.1 stream tcp $target"
+			sleep 2
+			echo "path 127.0.0.2 stream tcp $target"
+		elif [ "$port" = history ]; then
+			echo "path 127.0.0.2 stream tcp $((target + 1))"
+			echo "path 127.0.0.1 stream tcp $target"
+		else
+			for i in 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16; do
+				echo "path 127.0.0.$i stream tcp $port"
+			done
+		fi
+		echo
+		;;
+	esac
+done
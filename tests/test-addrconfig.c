@@ -0,0 +1,133 @@
+/* Copyright (c) 2013 Pavel Šimerda, Red Hat, Inc. (psimerda at redhat.com) and others
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "common.h"
+
+/* has_global_source:
+ *
+ * Find out independently of the library whether the host has a route and
+ * a source address beyond link-local scope for a global destination.
+ */
+static bool
+has_global_source(int family, const char *destination)
+{
+	struct sockaddr_storage sa = { 0 };
+	socklen_t salen = sizeof sa;
+	bool result = false;
+	int sock;
+
+	if (family == AF_INET) {
+		struct sockaddr_in *sin = (void *) &sa;
+
+		sin->sin_family = family;
+		sin->sin_port = htons(53);
+		inet_pton(family, destination, &sin->sin_addr);
+		salen = sizeof *sin;
+	} else {
+		struct sockaddr_in6 *sin6 = (void *) &sa;
+
+		sin6->sin6_family = family;
+		sin6->sin6_port = htons(53);
+		inet_pton(family, destination, &sin6->sin6_addr);
+		salen = sizeof *sin6;
+	}
+
+	if ((sock = socket(family, SOCK_DGRAM, 0)) == -1)
+		return false;
+	if (connect(sock, (void *) &sa, salen) == 0 && getsockname(sock, (void *) &sa, &salen) == 0) {
+		if (family == AF_INET) {
+			const uint8_t *address = (void *) &((struct sockaddr_in *) &sa)->sin_addr;
+
+			result = address[0] != 127 && !(address[0] == 169 && address[1] == 254);
+		} else {
+			const struct in6_addr *address = &((struct sockaddr_in6 *) &sa)->sin6_addr;
+
+			result = !IN6_IS_ADDR_LOOPBACK(address) && !IN6_IS_ADDR_LINKLOCAL(address);
+		}
+	}
+	close(sock);
+
+	return result;
+}
+
+static void
+check_families(netresolve_t context, bool exp_inet, bool exp_inet6)
+{
+	netresolve_query_t query;
+	bool inet = false, inet6 = false;
+	size_t i;
+
+	query = netresolve_query_forward(context, NULL, "80", NULL, NULL);
+	assert(query);
+	for (i = 0; i < netresolve_query_get_count(query); i++) {
+		int family;
+
+		netresolve_query_get_node_info(query, i, &family, NULL, NULL);
+		if (family == AF_INET)
+			inet = true;
+		else if (family == AF_INET6)
+			inet6 = true;
+	}
+	assert(inet == exp_inet);
+	assert(inet6 == exp_inet6);
+	netresolve_query_free(query);
+}
+
+int
+main(int argc, char **argv)
+{
+	bool inet = has_global_source(AF_INET, "192.0.2.1");
+	bool inet6 = has_global_source(AF_INET6, "2001:db8::1");
+	netresolve_t context;
+
+	context = netresolve_context_new();
+	assert(context);
+	netresolve_set_backend_string(context, "any");
+	netresolve_context_set_options(context,
+			NETRESOLVE_OPTION_PROTOCOL, IPPROTO_TCP,
+			NETRESOLVE_OPTION_DONE);
+
+	/* Without the option both families are returned. */
+	check_families(context, true, true);
+
+	/* With the option the family is narrowed to the only usable one and
+	 * kept unspecified when both or neither of them are usable.
+	 */
+	netresolve_context_set_options(context,
+			NETRESOLVE_OPTION_ADDRCONFIG, true,
+			NETRESOLVE_OPTION_DONE);
+	if (inet != inet6)
+		check_families(context, inet, inet6);
+	else
+		check_families(context, true, true);
+
+	/* An explicitly requested family is never changed. */
+	netresolve_context_set_options(context,
+			NETRESOLVE_OPTION_FAMILY, AF_INET6,
+			NETRESOLVE_OPTION_DONE);
+	check_families(context, false, true);
+
+	netresolve_context_free(context);
+
+	exit(EXIT_SUCCESS);
+}
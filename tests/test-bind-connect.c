@@ -22,9 +22,13 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 #include <netresolve-socket.h>
+#include <arpa/inet.h>
+#include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
 #include <assert.h>
 
 
@@ -58,21 +62,160 @@ do_connect(const char *node, const char *service, int family, int socktype, int
 
 	return sock;
 }
+
+/* Context using the exec helper, see `tests/exec-helper.sh`. */
+static netresolve_t
+exec_context(void)
+{
+	const char *srcdir = getenv("srcdir");
+	char backends[1024];
+	netresolve_t context;
+
+	context = netresolve_context_new();
+	assert(context);
+	snprintf(backends, sizeof backends, "exec:/bin/sh:%s/tests/exec-helper.sh", srcdir ? srcdir : ".");
+	netresolve_set_backend_string(context, backends);
+
+	return context;
+}
+
+static long
+connect_ms(netresolve_t context, const char *node, int *sock)
+{
+	struct timespec start, end;
+
+	*sock = -1;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	netresolve_connect(context, node, NULL, AF_INET, SOCK_STREAM, IPPROTO_TCP, on_socket, sock);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	return (end.tv_sec - start.tv_sec) * 1000L + (end.tv_nsec - start.tv_nsec) / 1000000;
+}
+
+/* A listener with a full backlog drops incoming SYNs, so connecting to it
+ * neither succeeds nor fails.
+ */
+static int
+blackhole(const char *address, int port, int *filler)
+{
+	struct sockaddr_in sa = { .sin_family = AF_INET, .sin_port = htons(port) };
+	int sock;
+	int status;
+
+	status = inet_pton(AF_INET, address, &sa.sin_addr);
+	assert(status == 1);
+	sock = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	assert(sock != -1);
+	status = bind(sock, (struct sockaddr *) &sa, sizeof sa);
+	assert(status == 0);
+	status = listen(sock, 0);
+	assert(status == 0);
+	*filler = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	assert(*filler != -1);
+	status = connect(*filler, (struct sockaddr *) &sa, sizeof sa);
+	assert(status == 0);
+
+	return sock;
+}
+
+struct payload {
+	int sock;
+	size_t sent;
+};
+
+static void
+on_payload_socket(netresolve_query_t query, int idx, int sock, void *user_data)
+{
+	struct payload *payload = user_data;
+
+	payload->sock = sock;
+	payload->sent = netresolve_connect_get_sent(query);
+}
+
+struct all {
+	int sock;
+	int count;
+	bool finished;
+};
+
+static void
+on_all_socket(netresolve_query_t query, int idx, int sock, void *user_data)
+{
+	struct all *all = user_data;
+
+	assert(!all->finished);
+
+	if (sock == -1) {
+		all->finished = true;
+		return;
+	}
+
+	all->sock = sock;
+	all->count++;
+}
+
+static void
+on_socket_set(netresolve_query_t query, int idx, const int *socks, int count, void *user_data)
+{
+	int *set = user_data;
+	int i;
+
+	for (i = 0; i < count; i++)
+		set[i] = socks[i];
+}
+
+struct pooled {
+	int sock;
+	bool reused;
+};
+
+static void
+on_pool_socket(netresolve_query_t query, int idx, int sock, void *user_data)
+{
+	struct pooled *pooled = user_data;
+
+	pooled->sock = sock;
+	pooled->reused = !query && idx == -1;
+}
+
+int
+do_pool_connect(netresolve_socket_pool_t pool, const char *node, const char *service, int family, int socktype, int protocol, bool *reused)
+{
+	struct pooled pooled = { .sock = -1 };
+
+	netresolve_socket_pool_connect(pool, node, service, family, socktype, protocol, on_pool_socket, &pooled);
+	*reused = pooled.reused;
+
+	return pooled.sock;
+}
+
 int
 main(int argc, char **argv)
 {
 	int sock_server, sock_client, sock_accept;
+	int sock_blackhole, sock_filler;
+	netresolve_t context;
+	char exec_node[64];
+	netresolve_socket_pool_t pool;
+	struct payload payload = { .sock = -1 };
+	int set[2] = { -1, -1 };
+	struct all all = { .sock = -1 };
 	const char *node = NULL;
 	const char *service = "1024";
 	int family = AF_INET;
 	int socktype = SOCK_STREAM;
 	int protocol = IPPROTO_TCP;
 	int status;
+	bool reused;
+	long ms;
 	char outbuf[6] = "asdf\n";
 	char inbuf[6] = {0};
 
 	sock_server = do_bind(node, service, family, socktype, protocol);
 	assert(sock_server > 0);
+	/* Keep the listener out of the exec helper started below. */
+	status = fcntl(sock_server, F_SETFD, FD_CLOEXEC);
+	assert(status == 0);
 	status = listen(sock_server, 10);
 	assert(status == 0);
 
@@ -87,10 +230,174 @@ main(int argc, char **argv)
 	assert(status == strlen(outbuf));
 	assert(!strcmp(inbuf, outbuf));
 
+	status = close(sock_client);
+	assert(status == 0);
+	status = close(sock_accept);
+	assert(status == 0);
+
+	/* Connecting starts with the first path instead of waiting for the rest. */
+	context = exec_context();
+	snprintf(exec_node, sizeof exec_node, "gap.%s", service);
+	ms = connect_ms(context, exec_node, &sock_client);
+	assert(sock_client > 0);
+	assert(ms < 1000);
+	sock_accept = accept(sock_server, NULL, 0);
+	assert(sock_accept != -1);
+	netresolve_context_free(context);
+
+	status = close(sock_client);
+	assert(status == 0);
+	status = close(sock_accept);
+	assert(status == 0);
+
+	/* The first address of `history` is refused and the connection falls
+	 * back to the second one right away despite the long delay.
+	 */
+	setenv("NETRESOLVE_CONNECT_DELAY", "2000", 1);
+	context = exec_context();
+	snprintf(exec_node, sizeof exec_node, "history.%s", service);
+	ms = connect_ms(context, exec_node, &sock_client);
+	assert(sock_client > 0);
+	assert(ms < 1000);
+	sock_accept = accept(sock_server, NULL, 0);
+	assert(sock_accept != -1);
+
+	status = close(sock_client);
+	assert(status == 0);
+	status = close(sock_accept);
+	assert(status == 0);
+
+	/* Now the first address doesn't answer at all. Having failed just
+	 * before, it's only tried after the address that worked, which doesn't
+	 * have to wait for the delay.
+	 */
+	sock_blackhole = blackhole("127.0.0.2", atoi(service) + 1, &sock_filler);
+	ms = connect_ms(context, exec_node, &sock_client);
+	assert(sock_client > 0);
+	assert(ms < 1000);
+	sock_accept = accept(sock_server, NULL, 0);
+	assert(sock_accept != -1);
+	netresolve_context_free(context);
+	unsetenv("NETRESOLVE_CONNECT_DELAY");
+
+	status = close(sock_client);
+	assert(status == 0);
+	status = close(sock_accept);
+	assert(status == 0);
+	status = close(sock_filler);
+	assert(status == 0);
+	status = close(sock_blackhole);
+	assert(status == 0);
+
+	/* Dual-stack connect falls back to the family that works. */
+	sock_client = do_connect(node, service, AF_UNSPEC, socktype, protocol);
+	assert(sock_client > 0);
+	sock_accept = accept(sock_server, NULL, 0);
+	assert(sock_accept != -1);
+
+	status = close(sock_client);
+	assert(status == 0);
+	status = close(sock_accept);
+	assert(status == 0);
+
+	/* The payload goes out with the SYN or is left to the caller. */
+	netresolve_connect_with_data(NULL, node, service, family, socktype, protocol,
+			outbuf, strlen(outbuf), on_payload_socket, &payload);
+	assert(payload.sock > 0);
+	assert(payload.sent <= strlen(outbuf));
+	status = send(payload.sock, outbuf + payload.sent, strlen(outbuf) - payload.sent, 0);
+	assert(status == strlen(outbuf) - payload.sent);
+	sock_accept = accept(sock_server, NULL, 0);
+	assert(sock_accept != -1);
+	memset(inbuf, 0, sizeof inbuf);
+	status = recv(sock_accept, inbuf, strlen(outbuf), MSG_WAITALL);
+	assert(status == strlen(outbuf));
+	assert(!strcmp(inbuf, outbuf));
+	status = close(payload.sock);
+	assert(status == 0);
+	status = close(sock_accept);
+	assert(status == 0);
+
+	/* Connecting to all addresses reports each connected socket. */
+	netresolve_connect_all(NULL, node, service, AF_UNSPEC, socktype, protocol, 1, 1000, on_all_socket, &all);
+	assert(all.finished);
+	assert(all.count == 1);
+	sock_accept = accept(sock_server, NULL, 0);
+	assert(sock_accept != -1);
+	status = close(all.sock);
+	assert(status == 0);
+	status = close(sock_accept);
+	assert(status == 0);
+
+	/* The pool connects a spare socket and hands it out next time. */
+	pool = netresolve_socket_pool_new(NULL, 1);
+	assert(pool);
+	sock_client = do_pool_connect(pool, node, service, family, socktype, protocol, &reused);
+	assert(sock_client > 0);
+	assert(!reused);
+	sock_accept = accept(sock_server, NULL, 0);
+	assert(sock_accept != -1);
+	status = close(sock_client);
+	assert(status == 0);
+	status = close(sock_accept);
+	assert(status == 0);
+
+	sock_client = do_pool_connect(pool, node, service, family, socktype, protocol, &reused);
+	assert(sock_client > 0);
+	assert(reused);
+	sock_accept = accept(sock_server, NULL, 0);
+	assert(sock_accept != -1);
+	status = send(sock_client, outbuf, strlen(outbuf), 0);
+	assert(status == strlen(outbuf));
+	memset(inbuf, 0, sizeof inbuf);
+	status = recv(sock_accept, inbuf, sizeof inbuf, 0);
+	assert(status == strlen(outbuf));
+	assert(!strcmp(inbuf, outbuf));
+	status = close(sock_client);
+	assert(status == 0);
+	status = close(sock_accept);
+	assert(status == 0);
+
+	/* A spare closed by the peer is dropped instead of handed out. The
+	 * peer resets the connection so that the port isn't left in TIME_WAIT
+	 * for the tests below.
+	 */
+	sock_accept = accept(sock_server, NULL, 0);
+	assert(sock_accept != -1);
+	status = setsockopt(sock_accept, SOL_SOCKET, SO_LINGER, &(struct linger) { .l_onoff = 1 }, sizeof (struct linger));
+	assert(status == 0);
+	status = close(sock_accept);
+	assert(status == 0);
+	usleep(100000);
+	sock_client = do_pool_connect(pool, node, service, family, socktype, protocol, &reused);
+	assert(sock_client > 0);
+	assert(!reused);
+	sock_accept = accept(sock_server, NULL, 0);
+	assert(sock_accept != -1);
+	netresolve_socket_pool_free(pool);
+
 	status = close(sock_server);
 	assert(status == 0);
 	status = close(sock_client);
 	assert(status == 0);
+	status = close(sock_accept);
+	assert(status == 0);
+
+	/* Nothing to connect to any more. */
+	sock_client = do_connect(node, service, AF_UNSPEC, socktype, protocol);
+	assert(sock_client == -1);
+
+	/* A set of listeners shares the port. */
+	netresolve_bind_set(NULL, node, service, family, socktype, protocol, 2, true, on_socket_set, set);
+	assert(set[0] > 0 && set[1] > 0);
+	sock_client = do_connect(node, service, family, socktype, protocol);
+	assert(sock_client > 0);
+	status = close(sock_client);
+	assert(status == 0);
+	status = close(set[0]);
+	assert(status == 0);
+	status = close(set[1]);
+	assert(status == 0);
 
 	return EXIT_SUCCESS;
 }
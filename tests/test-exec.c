@@ -0,0 +1,166 @@
+/* Copyright (c) 2013 Pavel Šimerda, Red Hat, Inc. (psimerda at redhat.com) and others
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <netresolve-epoll.h>
+#include "common.h"
+
+/* Enough pipelined data to fill the socket buffers in both directions. */
+#define QUERIES 2000
+#define PATHS 16
+
+static struct priv_common priv;
+static int reported[1 + PATHS];
+
+static void
+callback(netresolve_query_t query, void *user_data)
+{
+	int expected = (intptr_t) user_data;
+	size_t count = netresolve_query_get_count(query);
+	size_t i;
+
+	assert(count == PATHS);
+	for (i = 0; i < count; i++) {
+		int port;
+
+		netresolve_query_get_service_info(query, i, NULL, NULL, &port);
+		assert(port == expected);
+	}
+
+	priv.finished++;
+}
+
+static void
+callback_unix(netresolve_query_t query, void *user_data)
+{
+	const char *expected[] = { "/run/first.sock", "/run/second.sock" };
+	size_t i;
+
+	assert(netresolve_query_get_count(query) == 2);
+	for (i = 0; i < 2; i++) {
+		int family;
+		const void *address;
+
+		netresolve_query_get_node_info(query, i, &family, &address, NULL);
+		assert(family == AF_UNIX);
+		assert(!strcmp(address, expected[i]));
+	}
+
+	priv.finished++;
+}
+
+static void
+on_path(netresolve_query_t query, size_t idx, void *user_data)
+{
+	/* The first path comes from numerichost before exec starts. */
+	assert(idx >= 1 && idx <= PATHS);
+	assert(idx < netresolve_query_get_count(query));
+
+	reported[idx]++;
+}
+
+static void
+callback_failed(netresolve_query_t query, void *user_data)
+{
+	assert(netresolve_query_get_count(query) == 0);
+
+	priv.finished++;
+}
+
+static void
+callback_chain(netresolve_query_t query, void *user_data)
+{
+	priv.finished++;
+}
+
+int
+main(int argc, char **argv)
+{
+	const char *srcdir = getenv("srcdir");
+	char backends[1024];
+	char node[256];
+	char padding[200];
+	netresolve_t context;
+	netresolve_query_t query;
+	int i;
+
+	snprintf(backends, sizeof backends, "exec:persistent=2:/bin/sh:%s/tests/exec-helper.sh", srcdir ? srcdir : ".");
+	memset(padding, 'x', sizeof padding - 1);
+	padding[sizeof padding - 1] = '\0';
+
+	context = netresolve_epoll_new();
+	assert(context);
+	netresolve_set_backend_string(context, backends);
+
+	/* All requests are sent before any response is picked up. */
+	for (i = 1; i <= QUERIES; i++) {
+		snprintf(node, sizeof node, "%d.%s", i, padding);
+		assert(netresolve_query_forward(context, node, NULL, callback, (void *) (intptr_t) i));
+	}
+
+	netresolve_epoll_wait(context);
+	assert(priv.finished == QUERIES);
+
+	/* Each AF_UNIX path keeps its own address. */
+	netresolve_context_set_options(context, NETRESOLVE_OPTION_SOCKTYPE, SOCK_STREAM, NETRESOLVE_OPTION_DONE);
+	query = netresolve_query_forward(context, "unix", NULL, callback_unix, NULL);
+	assert(query);
+	netresolve_epoll_wait(context);
+	assert(priv.finished == QUERIES + 1);
+
+	/* A helper exiting in the middle of a response fails the query and
+	 * the next query to the same, least busy, helper starts a new one.
+	 */
+	query = netresolve_query_forward(context, "exit", NULL, callback_failed, NULL);
+	assert(query);
+	netresolve_epoll_wait(context);
+	assert(priv.finished == QUERIES + 2);
+	query = netresolve_query_forward(context, "7", NULL, callback, (void *) (intptr_t) 7);
+	assert(query);
+	netresolve_epoll_wait(context);
+	assert(priv.finished == QUERIES + 3);
+
+	netresolve_context_free(context);
+
+	/* Paths of a mandatory backend are reported once each as they arrive. */
+	context = netresolve_epoll_new();
+	assert(context);
+	snprintf(backends, sizeof backends, "numerichost,+exec:persistent:/bin/sh:%s/tests/exec-helper.sh", srcdir ? srcdir : ".");
+	netresolve_set_backend_string(context, backends);
+	netresolve_context_set_options(context,
+			NETRESOLVE_OPTION_SOCKTYPE, SOCK_STREAM,
+			NETRESOLVE_OPTION_PROTOCOL, IPPROTO_TCP,
+			NETRESOLVE_OPTION_PATH_CALLBACK, on_path,
+			NETRESOLVE_OPTION_DONE);
+	priv.finished = 0;
+	query = netresolve_query_forward(context, "1.2.3.4", NULL, callback_chain, NULL);
+	assert(query);
+	netresolve_epoll_wait(context);
+	assert(priv.finished);
+	assert(netresolve_query_get_count(query) == 1 + PATHS);
+	for (i = 1; i <= PATHS; i++)
+		assert(reported[i] == 1);
+
+	netresolve_context_free(context);
+
+	exit(EXIT_SUCCESS);
+}
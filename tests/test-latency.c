@@ -0,0 +1,82 @@
+/* Copyright (c) 2013 Pavel Šimerda, Red Hat, Inc. (psimerda at redhat.com) and others
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "common.h"
+#include <time.h>
+
+/* More than the number of samples needed before adaptive timeouts apply */
+#define QUERIES 120
+
+static long
+query_ms(netresolve_t context, const char *node, size_t *count)
+{
+	struct timespec start, end;
+	netresolve_query_t query;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	query = netresolve_query_forward(context, node, NULL, NULL, NULL);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	assert(query);
+	*count = netresolve_query_get_count(query);
+	netresolve_query_free(query);
+
+	return (end.tv_sec - start.tv_sec) * 1000L + (end.tv_nsec - start.tv_nsec) / 1000000;
+}
+
+int
+main(int argc, char **argv)
+{
+	const char *srcdir = getenv("srcdir");
+	char backends[1024];
+	netresolve_t context;
+	size_t count;
+	long ms;
+	int i;
+
+	setenv("NETRESOLVE_ADAPTIVE_TIMEOUTS", "yes", 1);
+	setenv("NETRESOLVE_PARTIAL_TIMEOUT", "5000", 1);
+	setenv("NETRESOLVE_PARTIAL_TIMEOUT_FLOOR", "20", 1);
+
+	context = netresolve_context_new();
+	assert(context);
+	snprintf(backends, sizeof backends, "exec:/bin/sh:%s/tests/exec-helper.sh", srcdir ? srcdir : ".");
+	netresolve_set_backend_string(context, backends);
+
+	/* All paths of these queries arrive at once. */
+	for (i = 0; i < QUERIES; i++) {
+		query_ms(context, "1", &count);
+		assert(count == 16);
+	}
+
+	/* The partial timeout has fallen to the floor, so the query doesn't
+	 * wait two seconds for the second path.
+	 */
+	ms = query_ms(context, "gap", &count);
+	assert(count == 1);
+	assert(ms < 1000);
+
+	netresolve_context_free(context);
+
+	exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,79 @@
+/* Copyright (c) 2013 Pavel Šimerda, Red Hat, Inc. (psimerda at redhat.com) and others
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <netresolve-epoll.h>
+#include "common.h"
+
+static void
+callback(netresolve_query_t query, void *user_data)
+{
+	struct priv_common *priv = user_data;
+
+	check_address(query, AF_INET, "1.2.3.4", 0);
+
+	priv->finished++;
+}
+
+static void
+callback_failed(netresolve_query_t query, void *user_data)
+{
+	struct priv_common *priv = user_data;
+
+	assert(netresolve_query_get_count(query) == 0);
+
+	priv->finished++;
+}
+
+int
+main(int argc, char **argv)
+{
+	struct priv_common priv = { 0 };
+	netresolve_t context;
+	netresolve_query_t query1, query2, query3;
+
+	/* The `libc` backend blocks and is run in a worker thread. */
+	context = netresolve_epoll_new();
+	assert(context);
+	netresolve_set_backend_string(context, "libc");
+	netresolve_context_set_options(context,
+			NETRESOLVE_OPTION_FAMILY, AF_INET,
+			NETRESOLVE_OPTION_PROTOCOL, IPPROTO_TCP,
+			NETRESOLVE_OPTION_DONE);
+
+	query1 = netresolve_query_forward(context, "1.2.3.4", "80", callback, &priv);
+	query2 = netresolve_query_forward(context, "1.2.3.4", "nonexistent-service", callback_failed, &priv);
+	assert(query1 && query2);
+	assert(priv.finished == 0);
+
+	/* Cancel a query with the setup in progress. */
+	query3 = netresolve_query_forward(context, "1.2.3.4", "80", NULL, NULL);
+	assert(query3);
+	netresolve_query_free(query3);
+
+	netresolve_epoll_wait(context);
+	assert(priv.finished == 2);
+
+	netresolve_context_free(context);
+
+	exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,74 @@
+/* Copyright (c) 2013 Pavel Šimerda, Red Hat, Inc. (psimerda at redhat.com) and others
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <netresolve-pool.h>
+#include <poll.h>
+#include "common.h"
+
+static void
+wait_finished(struct priv_common *priv, int count)
+{
+	while (__sync_fetch_and_add(&priv->finished, 0) < count)
+		usleep(1000);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct priv_common priv = { 0 };
+	netresolve_pool_t pool;
+	const char *node1 = "1:2:3:4:5:6:7:8%999999";
+	const char *node2 = "1.2.3.4%999999";
+	const char *service = "80";
+	struct pollfd pfd;
+	int protocol = IPPROTO_TCP;
+
+	/* Callbacks run in worker threads. */
+	pool = netresolve_pool_new(4);
+	assert(pool);
+	netresolve_pool_set_options(pool,
+			NETRESOLVE_OPTION_PROTOCOL, protocol,
+			NETRESOLVE_OPTION_DONE);
+	assert(netresolve_pool_query_forward(pool, node1, service, callback1, &priv));
+	assert(netresolve_pool_query_forward(pool, node2, service, callback2, &priv));
+	wait_finished(&priv, 2);
+	netresolve_pool_free(pool);
+
+	/* Callbacks are posted back to the main thread. */
+	pool = netresolve_pool_new(4);
+	assert(pool);
+	netresolve_pool_set_options(pool,
+			NETRESOLVE_OPTION_PROTOCOL, protocol,
+			NETRESOLVE_OPTION_DONE);
+	pfd.fd = netresolve_pool_fd(pool);
+	pfd.events = POLLIN;
+	assert(netresolve_pool_query_forward(pool, node1, service, callback1, &priv));
+	assert(netresolve_pool_query_forward(pool, node2, service, callback2, &priv));
+	while (priv.finished < 4) {
+		assert(poll(&pfd, 1, -1) == 1);
+		netresolve_pool_dispatch(pool);
+	}
+	netresolve_pool_free(pool);
+
+	exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,81 @@
+/* Copyright (c) 2013 Pavel Šimerda, Red Hat, Inc. (psimerda at redhat.com) and others
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "common.h"
+
+static void
+check_port(netresolve_query_t query, int exp_port)
+{
+	int socktype, protocol, port;
+
+	netresolve_query_get_service_info(query, 0, &socktype, &protocol, &port);
+	assert(protocol == IPPROTO_TCP);
+	assert(port == exp_port);
+}
+
+int
+main(int argc, char **argv)
+{
+	netresolve_t context;
+	netresolve_request_t request;
+	netresolve_query_t query1, query2;
+
+	context = netresolve_context_new();
+	assert(context);
+	netresolve_context_set_options(context,
+			NETRESOLVE_OPTION_FAMILY, AF_UNSPEC,
+			NETRESOLVE_OPTION_PROTOCOL, IPPROTO_TCP,
+			NETRESOLVE_OPTION_DONE);
+
+	/* Invalid options are caught when preparing the request. */
+	assert(!netresolve_request_new(context, -1, 0, NETRESOLVE_OPTION_DONE));
+
+	request = netresolve_request_new(context,
+			NETRESOLVE_OPTION_SERVICE_NAME, "80",
+			NETRESOLVE_OPTION_DONE);
+	assert(request);
+
+	/* The service name of the request is used by default. */
+	query1 = netresolve_request_forward(request, "1:2:3:4:5:6:7:8%999999", NULL, NULL, NULL);
+	check_address(query1, AF_INET6, "1:2:3:4:5:6:7:8", 999999);
+	check_port(query1, 80);
+
+	query2 = netresolve_request_forward(request, "1.2.3.4%999999", "443", NULL, NULL);
+	check_address(query2, AF_INET, "1.2.3.4", 999999);
+	check_port(query2, 443);
+
+	/* Queries outlive the request they were created from. */
+	netresolve_request_free(request);
+	check_address(query1, AF_INET6, "1:2:3:4:5:6:7:8", 999999);
+	check_port(query1, 80);
+	assert(!strcmp(netresolve_query_get_node_name(query1), "1:2:3:4:5:6:7:8%999999"));
+	check_address(query2, AF_INET, "1.2.3.4", 999999);
+	check_port(query2, 443);
+	assert(!strcmp(netresolve_query_get_node_name(query2), "1.2.3.4%999999"));
+
+	netresolve_query_free(query1);
+	netresolve_query_free(query2);
+	netresolve_context_free(context);
+
+	exit(EXIT_SUCCESS);
+}
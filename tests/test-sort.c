@@ -0,0 +1,127 @@
+/* Copyright (c) 2013 Pavel Šimerda, Red Hat, Inc. (psimerda at redhat.com) and others
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "common.h"
+
+/* Whether the kernel has a route to the address, which is how the sort
+ * tells usable destinations.
+ */
+static bool
+reachable(int family, const char *str)
+{
+	union {
+		struct sockaddr sa;
+		struct sockaddr_in sin;
+		struct sockaddr_in6 sin6;
+	} sa = { .sa = { .sa_family = family } };
+	socklen_t salen;
+	bool usable;
+	int sock;
+	int status;
+
+	if (family == AF_INET) {
+		sa.sin.sin_port = htons(9);
+		status = inet_pton(family, str, &sa.sin.sin_addr);
+		salen = sizeof sa.sin;
+	} else {
+		sa.sin6.sin6_port = htons(9);
+		status = inet_pton(family, str, &sa.sin6.sin6_addr);
+		salen = sizeof sa.sin6;
+	}
+	assert(status == 1);
+
+	if ((sock = socket(family, SOCK_DGRAM, 0)) == -1)
+		return false;
+	usable = connect(sock, &sa.sa, salen) == 0;
+	close(sock);
+
+	return usable;
+}
+
+static size_t
+position(netresolve_query_t query, const char *expected)
+{
+	size_t count = netresolve_query_get_count(query);
+	size_t i;
+
+	for (i = 0; i < count; i++) {
+		int family;
+		const void *address;
+		char str[INET6_ADDRSTRLEN];
+
+		netresolve_query_get_node_info(query, i, &family, &address, NULL);
+		if (inet_ntop(family, address, str, sizeof str) && !strcmp(str, expected))
+			return i;
+	}
+
+	assert(!"address not found");
+	return count;
+}
+
+int
+main(int argc, char **argv)
+{
+	const char *srcdir = getenv("srcdir");
+	char backends[1024];
+	netresolve_t context;
+	netresolve_query_t query;
+
+	context = netresolve_context_new();
+	assert(context);
+	snprintf(backends, sizeof backends, "exec:/bin/sh:%s/tests/exec-helper.sh", srcdir ? srcdir : ".");
+	netresolve_set_backend_string(context, backends);
+
+	query = netresolve_query_forward(context, "sort", NULL, NULL, NULL);
+	assert(query);
+	assert(netresolve_query_get_count(query) == 8);
+
+	/* Loopback destinations with equal keys keep the order of the backend
+	 * and come before global ones of the same precedence (rule 8).
+	 */
+	assert(position(query, "127.0.0.3") < position(query, "127.0.0.2"));
+	assert(position(query, "127.0.0.2") < position(query, "127.0.0.4"));
+	assert(position(query, "127.0.0.4") < position(query, "192.0.2.1"));
+
+	/* IPv6 loopback has a higher precedence than IPv4 (rule 6). */
+	if (reachable(AF_INET6, "::1")) {
+		assert(position(query, "::1") < position(query, "127.0.0.3"));
+	}
+
+	/* The limited broadcast address can't be connected to (rule 1). */
+	assert(!reachable(AF_INET, "255.255.255.255"));
+	assert(position(query, "255.255.255.255") > position(query, "127.0.0.4"));
+
+	/* IPv4 beats 6to4 and ULA destinations either by its label matching
+	 * the source (rule 5) or by precedence (rule 6).
+	 */
+	if (reachable(AF_INET, "192.0.2.1")) {
+		assert(position(query, "192.0.2.1") < position(query, "2002:c000:201::1"));
+		assert(position(query, "192.0.2.1") < position(query, "fd00::1"));
+		assert(position(query, "192.0.2.1") < position(query, "255.255.255.255"));
+	}
+
+	netresolve_query_free(query);
+	netresolve_context_free(context);
+
+	exit(EXIT_SUCCESS);
+}
@@ -22,6 +22,7 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 #include "common.h"
+#include <dlfcn.h>
 
 int
 main(int argc, char **argv)
@@ -40,6 +41,9 @@ main(int argc, char **argv)
 		abort();
 	}
 
+	/* Record events to be checked at the end. */
+	netresolve_set_trace(true);
+
 	/* Resolver configuration. */
 	netresolve_context_set_options(context,
 			NETRESOLVE_OPTION_FAMILY, family,
@@ -58,6 +62,70 @@ main(int argc, char **argv)
 	netresolve_query_free(query);
 
 	/* Check results */
+	{
+		FILE *trace = tmpfile();
+		char line[256];
+		int done = 0;
+
+		assert(trace);
+		netresolve_trace_dump(fileno(trace));
+		rewind(trace);
+		while (fgets(line, sizeof line, trace))
+			if (strstr(line, "state done"))
+				done++;
+		assert(done == 2);
+		fclose(trace);
+	}
+
+	/* Path fields are stored without truncation or not at all. */
+	{
+		netresolve_t wide = netresolve_context_new();
+		int value;
+
+		assert(wide);
+		netresolve_context_set_options(wide,
+				NETRESOLVE_OPTION_SOCKTYPE, SOCK_STREAM,
+				NETRESOLVE_OPTION_PROTOCOL, 262 /* IPPROTO_MPTCP */,
+				NULL);
+
+		query = netresolve_query_forward(wide, "1.2.3.4%16777215", NULL, NULL, NULL);
+		assert(netresolve_query_get_count(query) == 1);
+		netresolve_query_get_service_info(query, 0, NULL, &value, NULL);
+		assert(value == 262);
+		netresolve_query_get_node_info(query, 0, NULL, NULL, &value);
+		assert(value == 16777215);
+		netresolve_query_free(query);
+
+		query = netresolve_query_forward(wide, "1.2.3.4%16777216", NULL, NULL, NULL);
+		assert(netresolve_query_get_count(query) == 0);
+		netresolve_query_free(query);
+
+		netresolve_context_free(wide);
+	}
+
+	/* Backends following the one that answered are never loaded. */
+	{
+		netresolve_t lazy = netresolve_context_new();
+		const char *module = "libnetresolve-backend-nss.so";
+		void *handle;
+
+		assert(lazy);
+		netresolve_set_backend_string(lazy, "numerichost,nss:files");
+		netresolve_context_set_options(lazy, NETRESOLVE_OPTION_PROTOCOL, protocol, NULL);
+
+		query = netresolve_query_forward(lazy, "1.2.3.4", service, NULL, NULL);
+		check_address(query, AF_INET, "1.2.3.4", 0);
+		netresolve_query_free(query);
+		assert(!dlopen(module, RTLD_LAZY | RTLD_NOLOAD));
+
+		query = netresolve_query_forward(lazy, "example.invalid", service, NULL, NULL);
+		assert(netresolve_query_get_count(query) == 0);
+		netresolve_query_free(query);
+		assert((handle = dlopen(module, RTLD_LAZY | RTLD_NOLOAD)));
+		dlclose(handle);
+
+		netresolve_context_free(lazy);
+	}
 
 	/* Clean up. */
 	netresolve_context_free(context);
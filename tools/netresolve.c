@@ -113,13 +113,14 @@ main(int argc, char **argv)
 		{ "protocol", 1, 0, 'p' },
 		{ "backends", 1, 0, 'b' },
 		{ "srv", 0, 0, 'S' },
+		{ "addrconfig", 0, 0, 'A' },
 		{ "address", 1, 0, 'a' },
 		{ "port", 1, 0, 'P' },
 		{ "class", 1, 0, 'C' },
 		{ "type", 1, 0, 'T' },
 		{ NULL, 0, 0, 0 }
 	};
-	static const char *opts = "hvcn::s:f:t:p:b:Sa:P:";
+	static const char *opts = "hvcn::s:f:t:p:b:SAa:P:";
 	int opt, idx = 0;
 	bool connect = false;
 	char *nodename = NULL, *servname = NULL;
@@ -150,6 +151,7 @@ main(int argc, char **argv)
 					"-p,--protocol any|tcp|udp|sctp -- transport protocol\n"
 					"-b,--backends <backends> -- comma-separated list of backends\n"
 					"-S,--srv -- resolve DNS SRV record\n"
+					"-A,--addrconfig -- only look for addresses of families configured on the host\n"
 					"-a,--address -- IPv4/IPv6 address (reverse query)\n"
 					"-P,--port -- TCP/UDP port\n"
 					"-C,--class -- DNS record class\n"
@@ -190,6 +192,11 @@ main(int argc, char **argv)
 					NETRESOLVE_OPTION_DNS_SRV_LOOKUP, (int) true,
 					NETRESOLVE_OPTION_DONE);
 			break;
+		case 'A':
+			netresolve_context_set_options(context,
+					NETRESOLVE_OPTION_ADDRCONFIG, (int) true,
+					NETRESOLVE_OPTION_DONE);
+			break;
 		case 'a':
 			address_str = optarg;
 			break;
@@ -258,7 +265,10 @@ main(int argc, char **argv)
 		return EXIT_FAILURE;
 	}
 
-	debug("%s", netresolve_get_request_string(query));
+	const char *request_string = netresolve_get_request_string(query);
+
+	if (request_string)
+		debug("%s", request_string);
 
 	const char *response_string = netresolve_get_response_string(query);
 	char *dns_string = get_dns_string(query);